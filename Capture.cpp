@@ -0,0 +1,86 @@
+#include "Capture.hpp"
+#include "Clock.hpp"
+#include <stdexcept>
+#include <string.h>
+
+static const char magic[] = "IRCCAP1\n";
+static const size_t magic_size = 8;
+
+static void put(unsigned char *out, uint64_t value, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint64_t get(const unsigned char *in, int bytes) {
+	uint64_t value = 0;
+	for (int i = 0; i < bytes; i++)
+		value |= (uint64_t)in[i] << (8 * i);
+	return value;
+}
+
+Capture::Capture(const std::string &path)
+    : file(fopen(path.c_str(), "wb")), start(monotonic_nanoseconds()),
+      next_connection(0) {
+	if (file == NULL)
+		throw std::runtime_error("Error: Unable to open the capture file " + path);
+	setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+	fwrite(magic, 1, magic_size, file);
+}
+
+Capture::~Capture() {
+	fclose(file);
+}
+
+void Capture::write_record(record_type type, uint32_t connection, const char *data, size_t size) {
+	unsigned char header[17];
+	header[0] = (unsigned char)type;
+	put(header + 1, connection, 4);
+	put(header + 5, monotonic_nanoseconds() - start, 8);
+	put(header + 13, size, 4);
+	fwrite(header, 1, sizeof(header), file);
+	if (size != 0)
+		fwrite(data, 1, size, file);
+}
+
+void Capture::connected(int fd, const std::string &hostname) {
+	uint32_t connection = next_connection++;
+	connections[fd] = connection;
+	write_record(connect, connection, hostname.data(), hostname.size());
+}
+
+void Capture::received(int fd, const char *data, size_t size) {
+	std::map<int, uint32_t>::iterator it = connections.find(fd);
+	if (it != connections.end())
+		write_record(Capture::data, it->second, data, size);
+}
+
+void Capture::disconnected(int fd) {
+	std::map<int, uint32_t>::iterator it = connections.find(fd);
+	if (it == connections.end())
+		return;
+	write_record(disconnect, it->second, NULL, 0);
+	connections.erase(it);
+}
+
+void Capture::read_header(FILE *file) {
+	char header[magic_size];
+	if (fread(header, 1, magic_size, file) != magic_size ||
+	    memcmp(header, magic, magic_size) != 0)
+		throw std::runtime_error("Error: Not a capture file.");
+}
+
+bool Capture::read_record(FILE *file, record &r) {
+	unsigned char header[17];
+	size_t got = fread(header, 1, sizeof(header), file);
+	if (got == 0)
+		return false;
+	if (got != sizeof(header))
+		throw std::runtime_error("Error: Truncated capture record.");
+	r.type = (record_type)header[0];
+	r.connection = (uint32_t)get(header + 1, 4);
+	r.time = get(header + 5, 8);
+	r.data.resize(get(header + 13, 4));
+	if (!r.data.empty() && fread(&r.data[0], 1, r.data.size(), file) != r.data.size())
+		throw std::runtime_error("Error: Truncated capture record.");
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Traffic capture: every inbound byte of every connection, timestamped, in a
+// compact binary file that replay.cpp feeds back through a Server.
+//
+// The file starts with the 8 byte magic "IRCCAP1\n", followed by records:
+//
+//	u8  type		connect, data or disconnect
+//	u32 connection		numbered from 0 in connect order
+//	u64 time		nanoseconds since the capture started
+//	u32 size		followed by size bytes: the hostname for
+//				connect, the received bytes for data
+//
+// Integers are little-endian. Records are buffered and only hit the disk
+// when stdio's buffer fills or the capture is closed.
+class Capture {
+	public:
+		enum record_type {
+			connect = 1,
+			data = 2,
+			disconnect = 3,
+		};
+
+		struct record {
+			record_type type;
+			uint32_t    connection;
+			uint64_t    time;
+			std::string data;
+		};
+
+	private:
+		FILE                    *file;
+		uint64_t                start;
+		uint32_t                next_connection;
+		std::map<int, uint32_t> connections;
+		char                    buffer[1 << 16];
+
+		Capture(const Capture &src);
+		void write_record(record_type type, uint32_t connection, const char *data, size_t size);
+
+	public:
+		explicit Capture(const std::string &path);
+		~Capture();
+		void connected(int fd, const std::string &hostname);
+		void received(int fd, const char *data, size_t size);
+		void disconnected(int fd);
+
+		// Reading side, for replay. read_header throws on a file that is
+		// not a capture; read_record returns false at the end of file.
+		static void read_header(FILE *file);
+		static bool read_record(FILE *file, record &r);
+};
@@ -0,0 +1,98 @@
+#include "Channel.hpp"
+#include "Text.hpp"
+#include <algorithm>
+
+Channel::Channel(const std::string &name, const std::string &key, Client* admin)
+    : name(name), folded_name(fold_name(name)), key(key), admin(admin)
+{
+}
+
+Channel::~Channel()
+{
+}
+
+const std::string &Channel::get_name() const {
+    return name;
+}
+
+const std::string &Channel::get_folded_name() const {
+    return folded_name;
+}
+
+const std::string &Channel::get_key() const {
+    return key;
+}
+
+void Channel::set_key(const std::string &key) {
+    this->key = key;
+}
+
+Client *Channel::get_admin() const {
+    return admin;
+}
+
+const std::vector<Client *> &Channel::get_clients() const {
+    return clients;
+}
+
+const std::vector<std::pair<Client *, unsigned> > &Channel::get_links() const {
+    return links;
+}
+
+size_t Channel::size() const {
+    return clients.size();
+}
+
+bool Channel::has_client(Client *client) const {
+    return std::find(clients.begin(), clients.end(), client) != clients.end();
+}
+
+void Channel::add_client(Client *client) {
+    if (has_client(client))
+        return;
+    clients.push_back(client);
+    list_entry.clear();
+    who_entries.push_back(std::string());
+    if (!client->via)
+        return;
+    for (size_t i = 0; i < links.size(); ++i) {
+        if (links[i].first == client->via) {
+            links[i].second++;
+            return;
+        }
+    }
+    links.push_back(std::make_pair(client->via, 1u));
+}
+
+void Channel::remove_client(Client *client) {
+    client_iterator it = std::find(clients.begin(), clients.end(), client);
+    if (it == clients.end())
+        return;
+    who_entries.erase(who_entries.begin() + (it - clients.begin()));
+    clients.erase(it);
+    list_entry.clear();
+    for (size_t i = 0; client->via && i < links.size(); ++i) {
+        if (links[i].first == client->via && --links[i].second == 0) {
+            links.erase(links.begin() + i);
+            break;
+        }
+    }
+    if (admin == client) {
+        admin = clients.empty() ? NULL : clients.front();
+        if (admin)
+            who_entries.front().clear();
+    }
+}
+
+void Channel::forget_who_entry(Client *client) {
+    client_iterator it = std::find(clients.begin(), clients.end(), client);
+    if (it != clients.end())
+        who_entries[it - clients.begin()].clear();
+}
+
+bool Channel::is_banned(const Client *client) const {
+    if (bans.size() == 0)
+        return false;
+    std::string source = client->get_source();
+    return bans.matches(source) && !invite_exceptions.matches(source);
+}
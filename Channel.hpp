@@ -1,7 +1,10 @@
 #pragma once
 
-#include "Server.hpp"
+#include <string>
+#include <utility>
+#include <vector>
 #include "Client.hpp"
+#include "MaskSet.hpp"
 
 class Channel 
 {
@@ -10,15 +13,46 @@ class Channel
     private:
 
         std::string             name;
+        // fold_name(name): how channels, history and the log know it.
+        std::string             folded_name;
 		std::string				key;
         Client*                 admin;
         std::vector<Client *>   clients;
+        // Links with members here and how many each, so relaying a
+        // message does not have to go through the members.
+        std::vector<std::pair<Client *, unsigned> > links;
 
         Channel();
         Channel(const Channel& src);
     
     public:
 
+        // MODE +b and +I. Matching an invite exception lets a client past
+        // the bans; there is no +i for it to bypass yet.
+        MaskSet                 bans;
+        MaskSet                 invite_exceptions;
+        // Reply text kept between LIST and WHO requests; see Tasks.cpp.
+        // The part of the 322 line after the requester's nick, and of each
+        // member's 352 line in member order. An empty one is built when
+        // next asked for: changes empty only the entries they touch.
+        std::string             list_entry;
+        std::vector<std::string> who_entries;
+
         Channel(const std::string &name, const std::string &key, Client* admin);
         ~Channel();
+
+        const std::string               &get_name() const;
+        const std::string               &get_folded_name() const;
+        const std::string               &get_key() const;
+        Client                          *get_admin() const;
+        const std::vector<Client *>     &get_clients() const;
+        const std::vector<std::pair<Client *, unsigned> > &get_links() const;
+        size_t                          size() const;
+        bool                            has_client(Client *client) const;
+        void                            set_key(const std::string &key);
+        void                            add_client(Client *client);
+        void                            remove_client(Client *client);
+        bool                            is_banned(const Client *client) const;
+        // After the client's nick or operator status changed.
+        void                            forget_who_entry(Client *client);
 };
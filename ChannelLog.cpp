@@ -0,0 +1,505 @@
+#include "ChannelLog.hpp"
+#include "Clock.hpp"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct record_header {
+	uint64_t time;
+	uint32_t line_size;
+	uint16_t channel_size;
+	uint16_t padding;
+};
+
+static size_t record_size(size_t channel_size, size_t line_size) {
+	return (sizeof(record_header) + channel_size + line_size + 7) & ~(size_t)7;
+}
+
+static void fail(const std::string &what, const std::string &path) {
+	throw std::runtime_error("Error: " + what + " " + path + ": " + strerror(errno));
+}
+
+static void unmap(void *map, size_t size) {
+	if (map)
+		munmap(map, size);
+}
+
+ChannelLog::ChannelLog(const std::string &directory)
+    : directory(directory), last_time(0), stopping(false) {
+	counters.records = 0;
+	counters.bytes = 0;
+	counters.rotations = 0;
+	counters.stalls = 0;
+	counters.syncs = 0;
+	counters.dropped = 0;
+	if (mkdir(directory.c_str(), 0750) < 0 && errno != EEXIST)
+		fail("Unable to create", directory);
+	for (unsigned i = 0; i < LOG_SHARDS; i++) {
+		shards[i].spare_ready = false;
+		shards[i].next_sequence = 0;
+	}
+	recover();
+	for (unsigned i = 0; i < LOG_SHARDS; i++)
+		shards[i].active = open_segment(i, shards[i].next_sequence++);
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	if (pthread_create(&thread, NULL, run_thread, this) != 0)
+		throw std::runtime_error("Error: Unable to start the log thread.");
+}
+
+ChannelLog::~ChannelLog() {
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	pthread_cond_destroy(&wake);
+	pthread_mutex_destroy(&lock);
+
+	for (unsigned i = 0; i < LOG_SHARDS; i++) {
+		shard &sh = shards[i];
+		if (sh.active.map && sh.active.used) {
+			retire(sh.active);
+		} else if (sh.active.map) {
+			unmap(sh.active.map, LOG_SEGMENT_SIZE);
+			close(sh.active.fd);
+			unlink(sh.active.path.c_str());
+		}
+		if (sh.spare_ready) {
+			unmap(sh.spare.map, LOG_SEGMENT_SIZE);
+			close(sh.spare.fd);
+			unlink(sh.spare.path.c_str());
+		}
+	}
+}
+
+unsigned ChannelLog::shard_of(const std::string &channel) {
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (size_t i = 0; i < channel.size(); i++)
+		hash = (hash ^ (unsigned char)channel[i]) * 16777619u;
+	return hash % LOG_SHARDS;
+}
+
+ChannelLog::segment ChannelLog::open_segment(unsigned index, uint64_t sequence) {
+	char name[64];
+	snprintf(name, sizeof(name), "/%u-%020llu.log", index, (unsigned long long)sequence);
+	segment s;
+	s.path = directory + name;
+	s.fd = open(s.path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (s.fd < 0)
+		fail("Unable to create", s.path);
+	// Filesystems without fallocate get a sparse file instead.
+	if (posix_fallocate(s.fd, 0, LOG_SEGMENT_SIZE) != 0
+	    && ftruncate(s.fd, LOG_SEGMENT_SIZE) < 0) {
+		close(s.fd);
+		fail("Unable to allocate", s.path);
+	}
+	void *map = mmap(NULL, LOG_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, s.fd, 0);
+	if (map == MAP_FAILED) {
+		close(s.fd);
+		fail("Unable to map", s.path);
+	}
+	s.map = static_cast<char *>(map);
+	s.index.reserve(LOG_SEGMENT_SIZE / LOG_INDEX_INTERVAL + 1);
+	return s;
+}
+
+// Walks the records of map from s.used on, extending s as it goes. Returns
+// the offset the records end at.
+size_t ChannelLog::scan(const char *map, size_t size, segment &s) {
+	while (s.used + sizeof(record_header) <= size) {
+		record_header h;
+		memcpy(&h, map + s.used, sizeof(h));
+		size_t length = record_size(h.channel_size, h.line_size);
+		if (h.channel_size == 0 || s.used + length > size)
+			break;
+		if (s.index.empty() || s.used / LOG_INDEX_INTERVAL > s.index.back().offset / LOG_INDEX_INTERVAL) {
+			index_entry e = {h.time, s.used};
+			s.index.push_back(e);
+		}
+		if (s.used == 0)
+			s.first_time = h.time;
+		s.last_time = h.time;
+		s.used += length;
+	}
+	return s.used;
+}
+
+bool ChannelLog::starts_earlier(const segment &a, const segment &b) {
+	return a.first_time < b.first_time;
+}
+
+// Picks up the segments of a previous run. Sequence numbers are taken when a
+// segment is created, not when it becomes active: a rotation that finds no
+// spare ready numbers its own segment while the thread may be creating a
+// spare with the number before. So each shard's segments are ordered by
+// their first record, with the sequence breaking ties.
+void ChannelLog::recover() {
+	DIR *dir = opendir(directory.c_str());
+	if (!dir)
+		fail("Unable to open", directory);
+	std::vector<std::pair<std::pair<unsigned, unsigned long long>, std::string> > found;
+	dirent *d;
+	while ((d = readdir(dir))) {
+		unsigned index;
+		unsigned long long sequence;
+		char tail[8];
+		if (sscanf(d->d_name, "%u-%llu.%7s", &index, &sequence, tail) == 3
+		    && strcmp(tail, "log") == 0 && index < LOG_SHARDS)
+			found.push_back(std::make_pair(std::make_pair(index, sequence), d->d_name));
+	}
+	closedir(dir);
+	std::sort(found.begin(), found.end());
+
+	for (size_t i = 0; i < found.size(); i++) {
+		shard &sh = shards[found[i].first.first];
+		sh.next_sequence = found[i].first.second + 1;
+		segment s;
+		s.path = directory + "/" + found[i].second;
+
+		int fd = open(s.path.c_str(), O_RDWR | O_CLOEXEC);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) < 0)
+			fail("Unable to open", s.path);
+		void *map = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+		if (map == MAP_FAILED)
+			fail("Unable to map", s.path);
+
+		// An index gets the scan started at its last entry.
+		bool indexed = false;
+		FILE *index = fopen((s.path + ".idx").c_str(), "rb");
+		if (index) {
+			index_entry e;
+			while (fread(&e, sizeof(e), 1, index) == 1)
+				s.index.push_back(e);
+			fclose(index);
+			indexed = true;
+			if (!s.index.empty()) {
+				s.first_time = s.index[0].time;
+				s.used = s.index.back().offset;
+				s.index.pop_back();
+			}
+		}
+		uint64_t first_time = s.first_time;
+		scan(static_cast<char *>(map), st.st_size, s);
+		if (indexed)
+			s.first_time = first_time;
+		unmap(map, st.st_size);
+
+		if (s.used == 0) {
+			close(fd);
+			unlink(s.path.c_str());
+			unlink((s.path + ".idx").c_str());
+			continue;
+		}
+		if (!indexed) {
+			s.fd = fd;
+			retire(s);
+		} else {
+			close(fd);
+		}
+		s.fd = -1;
+		if (s.last_time > last_time)
+			last_time = s.last_time;
+		sh.closed.push_back(s);
+	}
+	for (unsigned i = 0; i < LOG_SHARDS; i++)
+		std::stable_sort(shards[i].closed.begin(), shards[i].closed.end(), starts_earlier);
+}
+
+// Makes a full or final segment durable: synced, cut to its records and
+// indexed. Closes and unmaps it.
+void ChannelLog::retire(segment &s) {
+	if (s.map) {
+		msync(s.map, s.used, MS_SYNC);
+		munmap(s.map, LOG_SEGMENT_SIZE);
+		s.map = NULL;
+	}
+	if (ftruncate(s.fd, s.used) < 0 || fsync(s.fd) < 0)
+		perror(s.path.c_str());
+	close(s.fd);
+	s.fd = -1;
+
+	std::string path = s.path + ".idx";
+	FILE *index = fopen(path.c_str(), "wb");
+	if (!index) {
+		perror(path.c_str());
+		return;
+	}
+	if (!s.index.empty())
+		fwrite(&s.index[0], sizeof(index_entry), s.index.size(), index);
+	fflush(index);
+	fsync(fileno(index));
+	fclose(index);
+}
+
+// Swaps in the spare segment, or a new one when the background thread has
+// not got one ready, and hands the full one to the thread.
+void ChannelLog::rotate(unsigned index) {
+	shard &sh = shards[index];
+	segment full = sh.active;
+	segment next;
+	bool ready;
+	uint64_t sequence = 0;
+
+	pthread_mutex_lock(&lock);
+	ready = sh.spare_ready;
+	if (ready) {
+		next = sh.spare;
+		sh.spare_ready = false;
+	} else {
+		sequence = sh.next_sequence++;
+	}
+	pthread_mutex_unlock(&lock);
+
+	std::string error;
+	if (!ready) {
+		counters.stalls++;
+		try {
+			next = open_segment(index, sequence);
+		} catch (std::exception &e) {
+			error = e.what();
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	sh.active = next;
+	if (full.map)
+		retiring.push_back(full);
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+
+	if (full.map && full.used) {
+		full.fd = -1;
+		full.map = NULL;
+		sh.closed.push_back(full);
+	}
+	if (!error.empty())
+		throw std::runtime_error(error);
+	counters.rotations++;
+}
+
+void ChannelLog::append(const std::string &channel, const std::string &line) {
+	size_t size = record_size(channel.size(), line.size());
+	if (channel.empty() || channel.size() > 0xffff || size > LOG_SEGMENT_SIZE)
+		return;
+	unsigned index = shard_of(channel);
+	segment &s = shards[index].active;
+	if (!s.map || s.used + size > LOG_SEGMENT_SIZE) {
+		try {
+			rotate(index);
+		} catch (std::exception &e) {
+			counters.dropped++;
+			return;
+		}
+	}
+
+	uint64_t time = realtime_nanoseconds();
+	if (time < last_time)
+		time = last_time;
+	last_time = time;
+	record_header h = {time, (uint32_t)line.size(), (uint16_t)channel.size(), 0};
+	char *at = s.map + s.used;
+	memcpy(at + sizeof(h), channel.data(), channel.size());
+	memcpy(at + sizeof(h) + channel.size(), line.data(), line.size());
+	memcpy(at, &h, sizeof(h));
+	if (s.index.empty() || s.used / LOG_INDEX_INTERVAL > s.index.back().offset / LOG_INDEX_INTERVAL) {
+		index_entry e = {time, s.used};
+		s.index.push_back(e);
+	}
+	if (s.used == 0)
+		s.first_time = time;
+	s.last_time = time;
+	s.used += size;
+	counters.records++;
+	counters.bytes += size;
+}
+
+void *ChannelLog::run_thread(void *log) {
+	static_cast<ChannelLog *>(log)->run();
+	return NULL;
+}
+
+void ChannelLog::run() {
+	uint64_t next_sync = monotonic_nanoseconds() + LOG_SYNC_INTERVAL * 1000000000ull;
+	pthread_mutex_lock(&lock);
+	while (true) {
+		std::vector<segment> full;
+		full.swap(retiring);
+		pthread_mutex_unlock(&lock);
+		for (size_t i = 0; i < full.size(); i++)
+			retire(full[i]);
+		pthread_mutex_lock(&lock);
+		if (stopping)
+			break;
+
+		for (unsigned i = 0; i < LOG_SHARDS; i++) {
+			if (shards[i].spare_ready)
+				continue;
+			uint64_t sequence = shards[i].next_sequence++;
+			pthread_mutex_unlock(&lock);
+			segment spare;
+			bool opened = true;
+			try {
+				spare = open_segment(i, sequence);
+			} catch (std::exception &e) {
+				fprintf(stderr, "%s\n", e.what());
+				opened = false;
+			}
+			pthread_mutex_lock(&lock);
+			if (opened) {
+				shards[i].spare = spare;
+				shards[i].spare_ready = true;
+			}
+		}
+
+		// The active segments' fds stay open until this thread retires
+		// them, so they can be synced outside the lock.
+		if (monotonic_nanoseconds() >= next_sync) {
+			int fds[LOG_SHARDS];
+			for (unsigned i = 0; i < LOG_SHARDS; i++)
+				fds[i] = shards[i].active.fd;
+			pthread_mutex_unlock(&lock);
+			for (unsigned i = 0; i < LOG_SHARDS; i++) {
+				if (fds[i] >= 0)
+					fdatasync(fds[i]);
+			}
+			__atomic_fetch_add(&counters.syncs, 1, __ATOMIC_RELAXED);
+			pthread_mutex_lock(&lock);
+			next_sync = monotonic_nanoseconds() + LOG_SYNC_INTERVAL * 1000000000ull;
+		}
+
+		if (retiring.empty() && !stopping) {
+			timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_sec += LOG_SYNC_INTERVAL;
+			pthread_cond_timedwait(&wake, &lock, &until);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+// Appends the lines of channel in [from, to) among the records between
+// offsets begin and end, stopping once out holds limit of them.
+static void scan_block(const char *map, size_t begin, size_t end, const std::string &channel,
+		       uint64_t from, uint64_t to, size_t limit, std::vector<ChannelLog::entry> &out) {
+	size_t offset = begin;
+	while (offset + sizeof(record_header) <= end && out.size() < limit) {
+		record_header h;
+		memcpy(&h, map + offset, sizeof(h));
+		if (h.channel_size == 0 || h.time >= to)
+			break;
+		const char *name = map + offset + sizeof(h);
+		if (h.time >= from && h.channel_size == channel.size()
+		    && memcmp(name, channel.data(), channel.size()) == 0) {
+			ChannelLog::entry e;
+			e.time = h.time;
+			e.line.assign(name + h.channel_size, h.line_size);
+			out.push_back(e);
+		}
+		offset += record_size(h.channel_size, h.line_size);
+	}
+}
+
+// The first `limit` lines from `from` on, or the last `limit` lines before
+// `to` when latest. Latest reads scan the index blocks back to front.
+void ChannelLog::read_segment(const char *map, size_t size, const segment &s,
+			      const std::string &channel, uint64_t from, uint64_t to,
+			      size_t limit, bool latest, std::vector<entry> &out) {
+	const std::vector<index_entry> &index = s.index;
+	// Blocks [0, first) end before `from`, blocks [last, n) start at or
+	// after `to`.
+	size_t first = 0, last = index.size();
+	size_t low = 0, high = index.size();
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+		if (index[middle].time < from)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	first = low > 0 ? low - 1 : 0;
+	low = first;
+	high = index.size();
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+		if (index[middle].time < to)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	last = low;
+	if (first >= last)
+		return;
+
+	if (!latest) {
+		scan_block(map, index[first].offset, size, channel, from, to, limit, out);
+		return;
+	}
+	std::vector<entry> block;
+	for (size_t k = last; k > first && out.size() < limit; k--) {
+		size_t end = k < index.size() ? index[k].offset : size;
+		block.clear();
+		scan_block(map, index[k - 1].offset, end, channel, from, to, (size_t)-1, block);
+		out.insert(out.begin(), block.begin(), block.end());
+	}
+}
+
+void ChannelLog::read(const std::string &channel, uint64_t from, uint64_t to,
+		      size_t limit, bool latest, std::vector<entry> &out) const {
+	const shard &sh = shards[shard_of(channel)];
+	std::vector<const segment *> segments;
+	for (size_t i = 0; i < sh.closed.size(); i++)
+		segments.push_back(&sh.closed[i]);
+	if (sh.active.map && sh.active.used)
+		segments.push_back(&sh.active);
+	if (latest)
+		std::reverse(segments.begin(), segments.end());
+
+	std::vector<entry> found;
+	for (size_t i = 0; i < segments.size() && found.size() < limit; i++) {
+		const segment &s = *segments[i];
+		if (s.last_time < from || s.first_time >= to)
+			continue;
+		std::vector<entry> lines;
+		size_t wanted = limit - found.size();
+		if (s.map) {
+			read_segment(s.map, s.used, s, channel, from, to, wanted, latest, lines);
+		} else {
+			int fd = open(s.path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				continue;
+			void *map = mmap(NULL, s.used, PROT_READ, MAP_SHARED, fd, 0);
+			close(fd);
+			if (map == MAP_FAILED)
+				continue;
+			read_segment(static_cast<char *>(map), s.used, s, channel, from, to, wanted, latest, lines);
+			munmap(map, s.used);
+		}
+		// Newest segments come first when reading the latest lines.
+		if (latest)
+			found.insert(found.begin(), lines.begin(), lines.end());
+		else
+			found.insert(found.end(), lines.begin(), lines.end());
+	}
+	if (found.size() > limit) {
+		if (latest)
+			found.erase(found.begin(), found.end() - limit);
+		else
+			found.resize(limit);
+	}
+	out.insert(out.end(), found.begin(), found.end());
+}
+
+const ChannelLog::stats &ChannelLog::get_stats() const {
+	return counters;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Append-only log of everything sent to channels. Channels are hashed onto
+// LOG_SHARDS shards and each shard writes into a series of segment files,
+// <directory>/<shard>-<sequence>.log, preallocated to LOG_SEGMENT_SIZE and
+// mapped into memory, so appending a line is a memcpy. Records are:
+//
+//	u64 time		wall clock nanoseconds, never decreasing
+//				within a shard
+//	u32 line size
+//	u16 channel size	0 marks the end of the segment
+//	u16 padding
+//	channel, then line, padded to 8 bytes
+//
+// Integers are in host byte order. A background thread keeps a mapped spare
+// segment ready for each shard, syncs the active segments every
+// LOG_SYNC_INTERVAL seconds and retires full ones: it syncs them, truncates
+// them to their used size and writes <segment>.idx next to them, the time of
+// the first record at or after every LOG_INDEX_INTERVAL bytes, as
+//
+//	u64 time
+//	u64 offset
+//
+// pairs. Time range reads binary search the index and scan from there.
+// Segments left by a previous run are picked up at startup, in the order of
+// their first records; one without an index was cut short and gets scanned,
+// truncated and indexed.
+#define LOG_SHARDS 4
+#define LOG_SEGMENT_SIZE (16 << 20)
+#define LOG_INDEX_INTERVAL (64 << 10)
+#define LOG_SYNC_INTERVAL 1
+
+class ChannelLog {
+	public:
+		struct stats {
+			unsigned long records;
+			uint64_t      bytes;
+			unsigned long rotations;
+			// Rotations that found no spare segment ready and had to
+			// create one in the event loop.
+			unsigned long stalls;
+			unsigned long syncs;
+			// Records lost because no segment could be created.
+			unsigned long dropped;
+		};
+
+		struct entry {
+			uint64_t    time;
+			std::string line;
+		};
+
+	private:
+		struct index_entry {
+			uint64_t time;
+			uint64_t offset;
+		};
+
+		struct segment {
+			std::string path;
+			int         fd;
+			char        *map;
+			size_t      used;
+			uint64_t    first_time;
+			uint64_t    last_time;
+			std::vector<index_entry> index;
+
+			segment() : fd(-1), map(NULL), used(0), first_time(0), last_time(0) {}
+		};
+
+		struct shard {
+			segment              active;
+			segment              spare;
+			bool                 spare_ready;
+			uint64_t             next_sequence;
+			// Segments already rotated out, oldest first. The map and
+			// fd are owned by the background thread.
+			std::vector<segment> closed;
+		};
+
+		std::string             directory;
+		shard                   shards[LOG_SHARDS];
+		uint64_t                last_time;
+		stats                   counters;
+
+		// Shared with the background thread, under lock.
+		pthread_t               thread;
+		pthread_mutex_t         lock;
+		pthread_cond_t          wake;
+		bool                    stopping;
+		std::vector<segment>    retiring;
+
+		ChannelLog(const ChannelLog &src);
+		ChannelLog &operator=(const ChannelLog &src);
+		static void *run_thread(void *log);
+		void    run();
+		void    recover();
+		static bool starts_earlier(const segment &a, const segment &b);
+		void    rotate(unsigned index);
+		segment open_segment(unsigned index, uint64_t sequence);
+		static void retire(segment &s);
+		static size_t scan(const char *map, size_t size, segment &s);
+		static unsigned shard_of(const std::string &channel);
+		static void read_segment(const char *map, size_t size, const segment &s,
+					 const std::string &channel, uint64_t from,
+					 uint64_t to, size_t limit, bool latest,
+					 std::vector<entry> &out);
+
+	public:
+		// Creates directory if needed and starts the background thread.
+		explicit ChannelLog(const std::string &directory);
+		// Stops the thread and truncates the active segments.
+		~ChannelLog();
+		void    append(const std::string &channel, const std::string &line);
+		// Lines of channel logged in [from, to), oldest first: the
+		// first `limit` of them, or the last `limit` when `latest`.
+		void    read(const std::string &channel, uint64_t from, uint64_t to,
+			     size_t limit, bool latest, std::vector<entry> &out) const;
+		const stats &get_stats() const;
+};
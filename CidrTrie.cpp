@@ -0,0 +1,211 @@
+#include "CidrTrie.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const unsigned char v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+bool ip_address::is_v4() const {
+	return memcmp(bytes, v4_mapped, sizeof(v4_mapped)) == 0;
+}
+
+ip_address ip_address::prefix(unsigned length) const {
+	ip_address result = *this;
+	for (unsigned i = 0; i < 16; i++) {
+		if (length >= 8 * (i + 1))
+			continue;
+		unsigned keep = length > 8 * i ? length - 8 * i : 0;
+		result.bytes[i] &= (unsigned char)(0xff00 >> keep);
+	}
+	return result;
+}
+
+static unsigned bit(const ip_address &address, unsigned index) {
+	return (address.bytes[index / 8] >> (7 - index % 8)) & 1;
+}
+
+// Number of leading bits a and b share, at most `limit`.
+static unsigned common_bits(const ip_address &a, const ip_address &b, unsigned limit) {
+	unsigned count = 0;
+	for (unsigned i = 0; i < 16 && count < limit; i++) {
+		unsigned char difference = a.bytes[i] ^ b.bytes[i];
+		if (difference == 0) {
+			count += 8;
+			continue;
+		}
+		while (!(difference & 0x80)) {
+			difference <<= 1;
+			count++;
+		}
+		break;
+	}
+	return count < limit ? count : limit;
+}
+
+CidrTrie::CidrTrie() : root(NULL), values(0) {
+}
+
+CidrTrie::~CidrTrie() {
+	destroy(root);
+}
+
+void CidrTrie::clear() {
+	destroy(root);
+	root = NULL;
+	values = 0;
+}
+
+size_t CidrTrie::size() const {
+	return values;
+}
+
+CidrTrie::node *CidrTrie::make_node(const ip_address &key, unsigned length) {
+	node *n = new node;
+	n->key = key.prefix(length);
+	n->length = length;
+	n->has_value = false;
+	n->value = 0;
+	n->child[0] = NULL;
+	n->child[1] = NULL;
+	return n;
+}
+
+void CidrTrie::destroy(node *n) {
+	if (n == NULL)
+		return;
+	destroy(n->child[0]);
+	destroy(n->child[1]);
+	delete n;
+}
+
+long &CidrTrie::at(const ip_address &address, unsigned length) {
+	node **slot = &root;
+	while (*slot != NULL) {
+		node *n = *slot;
+		unsigned common = common_bits(address, n->key, length < n->length ? length : n->length);
+		if (common < n->length) {
+			// The new prefix leaves n's path: put a node where they part.
+			node *split = make_node(address, common);
+			split->child[bit(n->key, common)] = n;
+			if (common < length)
+				split->child[bit(address, common)] = make_node(address, length);
+			*slot = split;
+			break;
+		}
+		if (length == n->length)
+			break;
+		slot = &n->child[bit(address, n->length)];
+	}
+	if (*slot == NULL)
+		*slot = make_node(address, length);
+	node *n = *slot;
+	while (n->length != length)
+		n = n->child[bit(address, n->length)];
+	if (!n->has_value) {
+		n->has_value = true;
+		n->value = 0;
+		values++;
+	}
+	return n->value;
+}
+
+long *CidrTrie::find(const ip_address &address, unsigned length) {
+	node *n = root;
+	while (n != NULL && n->length <= length) {
+		if (common_bits(address, n->key, n->length) < n->length)
+			return NULL;
+		if (n->length == length)
+			return n->has_value ? &n->value : NULL;
+		n = n->child[bit(address, n->length)];
+	}
+	return NULL;
+}
+
+const long *CidrTrie::longest_match(const ip_address &address) const {
+	const long *best = NULL;
+	const node *n = root;
+	while (n != NULL) {
+		if (common_bits(address, n->key, n->length) < n->length)
+			break;
+		if (n->has_value)
+			best = &n->value;
+		if (n->length == 128)
+			break;
+		n = n->child[bit(address, n->length)];
+	}
+	return best;
+}
+
+bool CidrTrie::erase(const ip_address &address, unsigned length) {
+	return erase(root, address, length);
+}
+
+// Clears the value and removes nodes that no longer hold one or join two
+// branches, so the trie stays compressed.
+bool CidrTrie::erase(node *&slot, const ip_address &address, unsigned length) {
+	node *n = slot;
+	if (n == NULL || n->length > length || common_bits(address, n->key, n->length) < n->length)
+		return false;
+	bool erased;
+	if (n->length == length) {
+		erased = n->has_value;
+		if (erased) {
+			n->has_value = false;
+			values--;
+		}
+	} else {
+		erased = erase(n->child[bit(address, n->length)], address, length);
+	}
+	if (!n->has_value && (n->child[0] == NULL || n->child[1] == NULL)) {
+		slot = n->child[0] ? n->child[0] : n->child[1];
+		delete n;
+	}
+	return erased;
+}
+
+bool CidrTrie::parse(const std::string &text, ip_address &address, unsigned &length) {
+	std::string host = text;
+	long bits = -1;
+	size_t slash = text.find('/');
+	if (slash != std::string::npos) {
+		host = text.substr(0, slash);
+		std::string count = text.substr(slash + 1);
+		char *end;
+		bits = strtol(count.c_str(), &end, 10);
+		if (count.empty() || *end != 0 || bits < 0)
+			return false;
+	}
+
+	in_addr v4;
+	in6_addr v6;
+	if (inet_pton(AF_INET, host.c_str(), &v4) == 1) {
+		if (bits > 32)
+			return false;
+		memcpy(address.bytes, v4_mapped, sizeof(v4_mapped));
+		memcpy(address.bytes + 12, &v4, 4);
+		length = bits < 0 ? 128 : 96 + bits;
+	} else if (inet_pton(AF_INET6, host.c_str(), &v6) == 1) {
+		if (bits > 128)
+			return false;
+		memcpy(address.bytes, &v6, 16);
+		length = bits < 0 ? 128 : bits;
+	} else {
+		return false;
+	}
+	address = address.prefix(length);
+	return true;
+}
+
+bool CidrTrie::from_sockaddr(const sockaddr *addr, ip_address &address) {
+	if (addr->sa_family == AF_INET) {
+		memcpy(address.bytes, v4_mapped, sizeof(v4_mapped));
+		memcpy(address.bytes + 12, &reinterpret_cast<const sockaddr_in *>(addr)->sin_addr, 4);
+		return true;
+	}
+	if (addr->sa_family == AF_INET6) {
+		memcpy(address.bytes, &reinterpret_cast<const sockaddr_in6 *>(addr)->sin6_addr, 16);
+		return true;
+	}
+	return false;
+}
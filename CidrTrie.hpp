@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <sys/socket.h>
+
+// An IPv6 address, or an IPv4 one mapped into ::ffff:0:0/96 so both
+// families share one trie.
+struct ip_address {
+	unsigned char bytes[16];
+
+	bool    is_v4() const;
+	// The address with everything past `length` bits cleared.
+	ip_address prefix(unsigned length) const;
+};
+
+// Compressed (PATRICIA) radix trie from IPv4/IPv6 prefixes to counters.
+// Each node covers a prefix and only exists where a stored prefix ends or
+// two stored prefixes part ways, so any lookup visits at most one node per
+// bit where stored prefixes diverge and never more than 128.
+//
+// The server keeps two: D-lines (banned prefixes, looked up by longest
+// match) and live connection counts per address and per subnet.
+class CidrTrie {
+	private:
+		struct node {
+			ip_address key;
+			unsigned   length;
+			bool       has_value;
+			long       value;
+			node       *child[2];
+		};
+
+		node    *root;
+		size_t  values;
+
+		CidrTrie(const CidrTrie &src);
+		CidrTrie &operator=(const CidrTrie &src);
+		static node *make_node(const ip_address &key, unsigned length);
+		static void destroy(node *n);
+		bool    erase(node *&slot, const ip_address &key, unsigned length);
+
+	public:
+		CidrTrie();
+		~CidrTrie();
+		// The value stored for exactly this prefix, created as 0.
+		long    &at(const ip_address &address, unsigned length);
+		// NULL when exactly this prefix is not stored.
+		long    *find(const ip_address &address, unsigned length);
+		// The value of the longest stored prefix containing the address,
+		// NULL when there is none.
+		const long *longest_match(const ip_address &address) const;
+		bool    erase(const ip_address &address, unsigned length);
+		size_t  size() const;
+		void    clear();
+
+		// "192.0.2.0/24", "2001:db8::/32" or a bare address. IPv4 prefix
+		// lengths come back shifted into the mapped range (+96).
+		static bool parse(const std::string &text, ip_address &address, unsigned &length);
+		// False for families other than AF_INET and AF_INET6.
+		static bool from_sockaddr(const sockaddr *addr, ip_address &address);
+};
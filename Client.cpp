@@ -1,15 +1,75 @@
 #include "Client.hpp"
+#include "Compressor.hpp"
+#include "Tls.hpp"
 
 Client::Client(int fd, int port, const std::string &hostname)
-    : fd(fd), port(port), hostname(hostname)
+    : fd(fd), port(port), hostname(hostname), password_ok(false),
+      registered(false), quitting(false), lexer(make_lex_state()),
+      parser(make_parse_state()), compressor(NULL), tls(NULL), capabilities(0),
+      negotiating(false), memory_total(0), oper(false), has_task(false), closing(false), kind(user), via(NULL)
 {
+	for (int i = 0; i < memory_kinds; i++)
+		memory[i] = 0;
 }
 
+int	Client::get_fd() const {
+	return fd;
+}
 int	Client::get_port() const {
 	return port;
 }
 std::string	Client::get_hostname() const {
 	return hostname;
 }
+const std::string	&Client::get_nickname() const {
+	return nickname;
+}
+const std::string	&Client::get_username() const {
+	return username;
+}
+const std::string	&Client::get_realname() const {
+	return realname;
+}
+const std::string	&Client::get_password() const {
+	return password;
+}
+std::string	Client::get_source() const {
+	return nickname + "!" + username + "@" + hostname;
+}
+bool	Client::is_password_ok() const {
+	return password_ok;
+}
+bool	Client::is_registered() const {
+	return registered;
+}
+bool	Client::is_quitting() const {
+	return quitting;
+}
+const std::string	&Client::get_quit_reason() const {
+	return quit_reason;
+}
+void	Client::set_nickname(const std::string &nickname) {
+	this->nickname = nickname;
+}
+void	Client::set_user(const std::string &username, const std::string &realname) {
+	this->username = username;
+	this->realname = realname;
+}
+void	Client::set_password_ok(bool ok) {
+	password_ok = ok;
+}
+void	Client::set_password(const std::string &password) {
+	this->password = password;
+}
+void	Client::set_registered() {
+	registered = true;
+}
+void	Client::set_quitting(const std::string &reason) {
+	quitting = true;
+	quit_reason = reason;
+}
 
-Client::~Client() { (void)fd; }
\ No newline at end of file
+Client::~Client() {
+	delete compressor;
+	delete tls;
+}
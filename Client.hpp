@@ -2,6 +2,12 @@
 
 #include <map>
 #include <iostream>
+#include <set>
+#include <string>
+#include "Parser.hpp"
+
+class Compressor;
+class TlsSession;
 
 class Client {
 	private:    
@@ -9,9 +15,86 @@ class Client {
         int             port;
 		std::string     hostname;
 	    std::map<int,	Client *> clients;
+
+		std::string     nickname;
+		std::string     username;
+		std::string     realname;
+		bool            password_ok;
+		bool            registered;
+		bool            quitting;
+		std::string     quit_reason;
+		std::string     password;
 	public:
+		enum client_kind {
+			user,        // A local user.
+			link,        // A connection to another server.
+			remote_user, // A user on another server; has no fd.
+		};
+		// Lexer and parser state survive between reads, so a line may
+		// arrive split over several recv calls.
+		lex_state       lexer;
+		parse_state     parser;
+		// Serialized lines waiting for POLLOUT.
+		std::string     output;
+		// After COMPRESS, output is compressed into `compressed` when
+		// it is flushed and sent from there.
+		Compressor      *compressor;
+		std::string     compressed;
+		// Clients of the TLS port; see Tls.hpp.
+		TlsSession      *tls;
+		std::set<std::string> channels;
+		// IRCv3 capabilities enabled with CAP REQ.
+		enum capability {
+			message_tags = 1,
+			server_time = 2,
+		};
+		unsigned        capabilities;
+		// From CAP LS or REQ to CAP END, registration waits.
+		bool            negotiating;
+		// Bytes held on this client's behalf, charged by Server::charge().
+		enum memory_kind {
+			memory_fixed,    // The Client itself, deflate and TLS state.
+			memory_input,    // A line read in part.
+			memory_output,   // Queued and in-flight output.
+			memory_channels, // Membership entries.
+			memory_kinds,
+		};
+		size_t          memory[memory_kinds];
+		size_t          memory_total;
+		// After OPER.
+		bool            oper;
+		// A LIST, NAMES or WHO reply is being sent a slice at a time;
+		// others may be waiting for it to finish.
+		bool            has_task;
+		// Set by Server::close_client(); the client is torn down at the
+		// end of the loop iteration and gets no reads or writes until then.
+		bool            closing;
+		client_kind     kind;
+		// For a link the peer's name, for a remote user the server it is
+		// on. Remote users are reached through `via`, a link.
+		std::string     server;
+		Client          *via;
+
 		Client(int fd, int port, const std::string &hostname);
+		int	get_fd() const;
 		int	get_port() const;
 		std::string	get_hostname() const;
+		const std::string	&get_nickname() const;
+		const std::string	&get_username() const;
+		const std::string	&get_realname() const;
+		// The last PASS given, checked against the link password.
+		const std::string	&get_password() const;
+		// nick!user@host, as used in message prefixes.
+		std::string	get_source() const;
+		bool	is_password_ok() const;
+		bool	is_registered() const;
+		bool	is_quitting() const;
+		const std::string	&get_quit_reason() const;
+		void	set_nickname(const std::string &nickname);
+		void	set_user(const std::string &username, const std::string &realname);
+		void	set_password_ok(bool ok);
+		void	set_password(const std::string &password);
+		void	set_registered();
+		void	set_quitting(const std::string &reason);
         ~Client();
-};
\ No newline at end of file
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Monotonic time in nanoseconds, for capture timestamps and latency stats.
+inline uint64_t monotonic_nanoseconds() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Wall clock time in nanoseconds since the epoch, for the channel log.
+inline uint64_t realtime_nanoseconds() {
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
@@ -0,0 +1,660 @@
+#include "Server.hpp"
+#include "Compressor.hpp"
+#include "IRCResponse.hpp"
+#include "Text.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <sstream>
+
+// Command handlers. dispatch() has already upper-cased the command and
+// checked registration for everything but the registration commands.
+
+static std::string target_name(Client *client) {
+    return client->get_nickname().empty() ? "*" : client->get_nickname();
+}
+
+static std::vector<std::string> split(const std::string &list, char separator) {
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, separator)) {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+// "nick" means nick!*@*, "user@host" means *!user@host.
+static std::string full_mask(const std::string &mask) {
+    bool has_nick = mask.find('!') != std::string::npos;
+    bool has_host = mask.find('@') != std::string::npos;
+    if (!has_nick && !has_host)
+        return mask + "!*@*";
+    if (!has_nick)
+        return "*!" + mask;
+    if (!has_host)
+        return mask + "@*";
+    return mask;
+}
+
+void Server::try_register(Client *client) {
+    if (client->is_registered() || client->negotiating || client->get_nickname().empty()
+        || client->get_username().empty())
+        return;
+    if (!client->is_password_ok()) {
+        reply(client, IRCResponse::ERR_PASSWDMISMATCH(target_name(client)));
+        client->set_quitting("Password incorrect");
+        return;
+    }
+    if (klines.matches(client->get_username() + "@" + client->get_hostname())) {
+        reply(client, IRCResponse::ERR_YOUREBANNEDCREEP(client->get_nickname()));
+        client->set_quitting("K-lined");
+        return;
+    }
+    client->set_registered();
+    reply(client, IRCResponse::RPL_WELCOME(client->get_nickname()));
+    propagate(introduction(client, 1), NULL);
+}
+
+void Server::cmd_pass(Client *client, const message &m) {
+    if (client->is_registered()) {
+        reply(client, IRCResponse::ERR_ALREADYREGISTERED(target_name(client)));
+        return;
+    }
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    client->set_password(m.params[0]);
+    client->set_password_ok(m.params[0] == pass);
+}
+
+void Server::cmd_nick(Client *client, const message &m) {
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NONICKNAMEGIVEN(target_name(client)));
+        return;
+    }
+    const std::string &nickname = m.params[0];
+    std::string folded = fold_name(nickname);
+    std::map<std::string, Client *>::iterator taken = nicknames.find(folded);
+    if (taken != nicknames.end() && taken->second != client) {
+        reply(client, IRCResponse::ERR_NICKNAMEINUSE(nickname));
+        return;
+    }
+    if (nickname == client->get_nickname())
+        return;
+
+    if (client->is_registered()) {
+        std::string line = ":" + client->get_source() + " NICK :" + nickname;
+        std::set<Client *> peers;
+        for (std::set<std::string>::iterator it = client->channels.begin(); it != client->channels.end(); ++it) {
+            const std::vector<Client *> &members = channels[*it]->get_clients();
+            peers.insert(members.begin(), members.end());
+        }
+        peers.insert(client);
+        for (std::set<Client *>::iterator it = peers.begin(); it != peers.end(); ++it)
+            send_to(*it, line);
+        propagate(line, NULL);
+    }
+    nicknames.erase(fold_name(client->get_nickname()));
+    nicknames[folded] = client;
+    client->set_nickname(nickname);
+    forget_who_entries(client);
+    try_register(client);
+}
+
+void Server::cmd_user(Client *client, const message &m) {
+    if (client->is_registered()) {
+        reply(client, IRCResponse::ERR_ALREADYREGISTERED(target_name(client)));
+        return;
+    }
+    if (m.params.size() < 4) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    client->set_user(m.params[0], m.params[3]);
+    try_register(client);
+}
+
+void Server::cmd_ping(Client *client, const message &m) {
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    send_to(client, IRCResponse::RPL_PING(host, m.params[0]));
+}
+
+void Server::cmd_pong(Client *client, const message &m) {
+    (void)client;
+    (void)m;
+}
+
+void Server::cmd_quit(Client *client, const message &m) {
+    client->set_quitting(m.params.empty() ? "Client quit" : m.params[0]);
+}
+
+void Server::cmd_join(Client *client, const message &m) {
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    std::vector<std::string> names = split(m.params[0], ',');
+    std::vector<std::string> keys;
+    if (m.params.size() > 1)
+        keys = split(m.params[1], ',');
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        const std::string &name = names[i];
+        std::string key = i < keys.size() ? keys[i] : "";
+        if (name[0] != '#' && name[0] != '&') {
+            reply(client, IRCResponse::ERR_NOSUCHCHANNEL(target_name(client), name));
+            continue;
+        }
+
+        Channel *channel;
+        bool created = false;
+        std::string folded = fold_name(name);
+        std::map<std::string, Channel *>::iterator it = channels.find(folded);
+        if (it == channels.end()) {
+            channel = new Channel(name, key, client);
+            channels[folded] = channel;
+            created = true;
+        } else {
+            channel = it->second;
+            if (channel->has_client(client))
+                continue;
+            if (!channel->get_key().empty() && channel->get_key() != key) {
+                reply(client, IRCResponse::ERR_BADCHANNELKEY(target_name(client), name));
+                continue;
+            }
+            if (channel->is_banned(client)) {
+                reply(client, IRCResponse::ERR_BANNEDFROMCHAN(target_name(client), name));
+                continue;
+            }
+        }
+
+        // Replies spell the channel as whoever created it did.
+        const std::string &spelled = channel->get_name();
+        channel->add_client(client);
+        client->channels.insert(folded);
+        charge(client, Client::memory_channels, MEMBERSHIP_BYTES + folded.size());
+        broadcast(channel, IRCResponse::RPL_JOIN(client->get_source(), spelled), NULL);
+        // Other servers learn the key from the JOIN that created the channel.
+        propagate(":" + client->get_source() + " JOIN " + spelled
+                  + (created && !key.empty() ? " " + key : ""), NULL);
+
+        std::string names_list;
+        const std::vector<Client *> &members = channel->get_clients();
+        for (size_t j = 0; j < members.size(); ++j) {
+            if (j != 0)
+                names_list += " ";
+            if (members[j] == channel->get_admin())
+                names_list += "@";
+            names_list += members[j]->get_nickname();
+        }
+        reply(client, IRCResponse::RPL_NAMREPLY(client->get_nickname(), spelled, names_list));
+        reply(client, IRCResponse::RPL_ENDOFNAMES(client->get_nickname(), spelled));
+        replay_history(client, folded, HISTORY_JOIN_LINES);
+    }
+}
+
+void Server::notify_peers(Client *client, const std::string &line) {
+    std::set<Client *> peers;
+    for (std::set<std::string>::iterator it = client->channels.begin(); it != client->channels.end(); ++it) {
+        const std::vector<Client *> &members = channels[*it]->get_clients();
+        peers.insert(members.begin(), members.end());
+    }
+    peers.erase(client);
+    for (std::set<Client *>::iterator it = peers.begin(); it != peers.end(); ++it) {
+        if (!(*it)->closing)
+            send_to(*it, line);
+    }
+}
+
+void Server::part_channel(Client *client, Channel *channel) {
+    std::string folded = fold_name(channel->get_name());
+    channel->remove_client(client);
+    client->channels.erase(folded);
+    charge(client, Client::memory_channels, -(ptrdiff_t)(MEMBERSHIP_BYTES + folded.size()));
+    if (channel->size() == 0) {
+        channels.erase(folded);
+        delete channel;
+    }
+}
+
+void Server::cmd_part(Client *client, const message &m) {
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    std::vector<std::string> names = split(m.params[0], ',');
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::map<std::string, Channel *>::iterator it = channels.find(fold_name(names[i]));
+        if (it == channels.end()) {
+            reply(client, IRCResponse::ERR_NOSUCHCHANNEL(target_name(client), names[i]));
+            continue;
+        }
+        if (!it->second->has_client(client)) {
+            reply(client, IRCResponse::ERR_NOTONCHANNEL(target_name(client), names[i]));
+            continue;
+        }
+        std::string line = IRCResponse::RPL_PART(client->get_source(), it->second->get_name());
+        broadcast(it->second, line, NULL);
+        propagate(line, NULL);
+        part_channel(client, it->second);
+    }
+}
+
+// PRIVMSG, NOTICE and TAGMSG; NOTICE never gets an error reply. The
+// sender's client-only tags go to recipients that enabled message-tags;
+// TAGMSG, which is nothing but tags, only to those, and neither to links
+// nor into history.
+void Server::send_text(Client *client, const message &m, const std::string &command) {
+    bool notice = command == "NOTICE";
+    bool tags_only = command == "TAGMSG";
+    if (m.params.size() < (tags_only ? 1u : 2u)) {
+        if (!notice)
+            reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), command));
+        return;
+    }
+    std::string tags = m.tags.empty() ? std::string() : client_tags(m.tags);
+    if (tags_only && tags.empty())
+        return;
+    std::vector<std::string> targets = split(m.params[0], ',');
+    for (size_t i = 0; i < targets.size(); ++i) {
+        const std::string &target = targets[i];
+        std::string line = ":" + client->get_source() + " " + command + " " + target;
+        if (!tags_only)
+            line += " :" + m.params[1];
+        tagged_line tagged(line, tags, tags_only);
+
+        if (target[0] == '#' || target[0] == '&') {
+            std::map<std::string, Channel *>::iterator it = channels.find(fold_name(target));
+            if (it == channels.end()) {
+                if (!notice)
+                    reply(client, IRCResponse::ERR_NOSUCHCHANNEL(target_name(client), target));
+                continue;
+            }
+            if (!it->second->has_client(client) || it->second->is_banned(client)) {
+                if (!notice)
+                    reply(client, IRCResponse::ERR_CANNOTSENDTOCHAN(target_name(client), target));
+                continue;
+            }
+            if (notice && it->second->size() >= LARGE_CHANNEL
+                && overload.get_stage() >= Overload::drop_notices) {
+                overload.count_dropped_notice();
+                continue;
+            }
+            broadcast(it->second, tagged, client);
+            if (tags_only)
+                continue;
+            relay(it->second, line, client);
+            history.append(it->first, line);
+            continue;
+        }
+
+        std::map<std::string, Client *>::iterator it = nicknames.find(fold_name(target));
+        if (it == nicknames.end()) {
+            if (!notice)
+                reply(client, IRCResponse::ERR_NOSUCHNICK(target_name(client), target));
+            continue;
+        }
+        Client *recipient = it->second;
+        if (recipient->via) {
+            if (!tags_only)
+                send_to(recipient->via, line);
+            continue;
+        }
+        const std::string &out = tagged.for_client(recipient);
+        if (!out.empty())
+            send_to(recipient, out);
+    }
+}
+
+void Server::cmd_privmsg(Client *client, const message &m) {
+    send_text(client, m, "PRIVMSG");
+}
+
+void Server::cmd_notice(Client *client, const message &m) {
+    send_text(client, m, "NOTICE");
+}
+
+void Server::cmd_tagmsg(Client *client, const message &m) {
+    send_text(client, m, "TAGMSG");
+}
+
+static const struct {
+    const char *name;
+    Client::capability flag;
+} capabilities[] = {
+    {"message-tags", Client::message_tags},
+    {"server-time", Client::server_time},
+};
+
+static const size_t capability_count = sizeof(capabilities) / sizeof(*capabilities);
+
+static std::string capability_names(unsigned flags) {
+    std::string names;
+    for (size_t i = 0; i < capability_count; ++i) {
+        if (!(flags & capabilities[i].flag))
+            continue;
+        if (!names.empty())
+            names += " ";
+        names += capabilities[i].name;
+    }
+    return names;
+}
+
+// IRCv3 capability negotiation: LS, LIST, REQ and END, without values. A
+// client that sends LS or REQ before registering stays unregistered until
+// END. REQ takes all the capabilities asked for or none.
+void Server::cmd_cap(Client *client, const message &m) {
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    std::string subcommand = m.params[0];
+    for (size_t i = 0; i < subcommand.size(); ++i)
+        subcommand[i] = toupper((unsigned char)subcommand[i]);
+    std::string start = "CAP " + target_name(client) + " ";
+    if (subcommand == "LS") {
+        if (!client->is_registered())
+            client->negotiating = true;
+        reply(client, start + "LS :" + capability_names(~0u));
+    } else if (subcommand == "LIST") {
+        reply(client, start + "LIST :" + capability_names(client->capabilities));
+    } else if (subcommand == "REQ") {
+        if (!client->is_registered())
+            client->negotiating = true;
+        std::string requested = m.params.size() > 1 ? m.params[1] : "";
+        std::vector<std::string> names = split(requested, ' ');
+        unsigned enable = 0, disable = 0;
+        for (size_t i = 0; i < names.size(); ++i) {
+            bool off = names[i][0] == '-';
+            std::string name = names[i].substr(off);
+            size_t k = 0;
+            while (k < capability_count && name != capabilities[k].name)
+                ++k;
+            if (k == capability_count) {
+                reply(client, start + "NAK :" + requested);
+                return;
+            }
+            (off ? disable : enable) |= capabilities[k].flag;
+        }
+        client->capabilities = (client->capabilities | enable) & ~disable;
+        reply(client, start + "ACK :" + requested);
+    } else if (subcommand == "END") {
+        client->negotiating = false;
+        try_register(client);
+    } else {
+        reply(client, IRCResponse::ERR_INVALIDCAPCMD(target_name(client), m.params[0]));
+    }
+}
+
+// Channel modes: the +b and +I lists, changed by the channel admin and
+// listed when given without a mask. User modes are not supported and are
+// ignored, so clients that set them on connect get no error.
+void Server::cmd_mode(Client *client, const message &m) {
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    const std::string &name = m.params[0];
+    if (name[0] != '#' && name[0] != '&')
+        return;
+    std::map<std::string, Channel *>::iterator it = channels.find(fold_name(name));
+    if (it == channels.end()) {
+        reply(client, IRCResponse::ERR_NOSUCHCHANNEL(target_name(client), name));
+        return;
+    }
+    Channel *channel = it->second;
+    if (m.params.size() == 1) {
+        reply(client, IRCResponse::RPL_CHANNELMODEIS(target_name(client), name,
+                                                     channel->get_key().empty() ? "+" : "+k"));
+        return;
+    }
+
+    const std::string &modes = m.params[1];
+    size_t next_param = 2;
+    bool adding = true;
+    char applied_sign = 0;
+    std::string applied, applied_params;
+    for (size_t i = 0; i < modes.size(); ++i) {
+        char mode = modes[i];
+        if (mode == '+' || mode == '-') {
+            adding = mode == '+';
+            continue;
+        }
+        if (mode != 'b' && mode != 'I') {
+            reply(client, IRCResponse::ERR_UNKNOWNMODE(target_name(client), mode));
+            continue;
+        }
+        MaskSet &list = mode == 'b' ? channel->bans : channel->invite_exceptions;
+        if (next_param >= m.params.size()) {
+            const std::vector<std::string> &masks = list.get_masks();
+            for (size_t j = 0; j < masks.size(); ++j) {
+                reply(client, mode == 'b'
+                    ? IRCResponse::RPL_BANLIST(target_name(client), name, masks[j])
+                    : IRCResponse::RPL_INVITELIST(target_name(client), name, masks[j]));
+            }
+            reply(client, mode == 'b'
+                ? IRCResponse::RPL_ENDOFBANLIST(target_name(client), name)
+                : IRCResponse::RPL_ENDOFINVITELIST(target_name(client), name));
+            continue;
+        }
+        std::string mask = full_mask(m.params[next_param++]);
+        if (channel->get_admin() != client) {
+            reply(client, IRCResponse::ERR_CHANOPRIVSNEEDED(target_name(client), name));
+            continue;
+        }
+        if (!(adding ? list.add(mask) : list.remove(mask)))
+            continue;
+        char sign = adding ? '+' : '-';
+        if (sign != applied_sign)
+            applied += sign;
+        applied_sign = sign;
+        applied += mode;
+        if (!applied_params.empty())
+            applied_params += " ";
+        applied_params += mask;
+    }
+    if (!applied.empty()) {
+        std::string line = IRCResponse::RPL_MODE(client->get_source(), name, applied, applied_params);
+        broadcast(channel, line, NULL);
+        propagate(line, NULL);
+    }
+}
+
+// "timestamp=YYYY-MM-DDThh:mm:ss.sssZ" as nanoseconds since the epoch.
+static bool parse_timestamp(const std::string &reference, uint64_t &time) {
+    if (reference.compare(0, 10, "timestamp=") != 0)
+        return false;
+    struct tm t = {};
+    int milliseconds = 0;
+    if (sscanf(reference.c_str() + 10, "%4d-%2d-%2dT%2d:%2d:%2d.%3dZ", &t.tm_year, &t.tm_mon,
+               &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec, &milliseconds) < 6)
+        return false;
+    t.tm_year -= 1900;
+    t.tm_mon -= 1;
+    time_t seconds = timegm(&t);
+    if (seconds < 0)
+        return false;
+    time = (uint64_t)seconds * 1000000000u + (uint64_t)milliseconds * 1000000u;
+    return true;
+}
+
+// CHATHISTORY on a channel the client is on:
+//
+//	LATEST <channel> * <limit>			from the in-memory history
+//	BEFORE <channel> timestamp=<time> <limit>	from the channel log,
+//	AFTER <channel> timestamp=<time> <limit>	when it is enabled
+//	BETWEEN <channel> timestamp=<a> timestamp=<b> <limit>
+//
+// Neither keeps message ids, so only * and timestamps work as references.
+void Server::cmd_chathistory(Client *client, const message &m) {
+    if (m.params.size() < 4) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    std::string subcommand = m.params[0];
+    for (size_t i = 0; i < subcommand.size(); ++i)
+        subcommand[i] = toupper((unsigned char)subcommand[i]);
+    bool between = subcommand == "BETWEEN";
+    if (between && m.params.size() < 5) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    uint64_t from = 0, to = (uint64_t)-1;
+    bool valid;
+    if (subcommand == "LATEST")
+        valid = m.params[2] == "*";
+    else if (subcommand == "BEFORE")
+        valid = channel_log && parse_timestamp(m.params[2], to);
+    else if (subcommand == "AFTER")
+        valid = channel_log && parse_timestamp(m.params[2], from);
+    else if (between)
+        valid = channel_log && parse_timestamp(m.params[2], from) && parse_timestamp(m.params[3], to);
+    else
+        valid = false;
+    if (!valid) {
+        reply(client, IRCResponse::FAIL(m.command, "INVALID_PARAMS", subcommand,
+                                        channel_log ? "Only * and timestamp= references are supported"
+                                                    : "Only LATEST with * is supported"));
+        return;
+    }
+    const std::string &name = m.params[1];
+    std::map<std::string, Channel *>::iterator it = channels.find(fold_name(name));
+    if (it == channels.end() || !it->second->has_client(client)) {
+        reply(client, IRCResponse::FAIL(m.command, "INVALID_TARGET", subcommand + " " + name,
+                                        "Messages could not be retrieved"));
+        return;
+    }
+    long limit = atol(m.params[between ? 4 : 3].c_str());
+    if (limit <= 0) {
+        reply(client, IRCResponse::FAIL(m.command, "INVALID_PARAMS", subcommand,
+                                        "Invalid limit"));
+        return;
+    }
+    if (limit > HISTORY_LINES)
+        limit = HISTORY_LINES;
+    if (subcommand == "LATEST") {
+        replay_history(client, it->first, limit);
+        return;
+    }
+    // BETWEEN may give its bounds in either order.
+    if (between && from > to)
+        std::swap(from, to);
+    std::vector<ChannelLog::entry> lines;
+    channel_log->read(it->first, from, to, limit, subcommand == "BEFORE", lines);
+    for (size_t i = 0; i < lines.size(); ++i)
+        send_to(client, lines[i].line);
+}
+
+// COMPRESS DEFLATE, after IMAP's COMPRESS (RFC 4978) but one way: the reply
+// is the last thing the client gets uncompressed, everything after it is a
+// zlib stream; see Compressor.hpp. What the client sends stays as it is.
+void Server::cmd_compress(Client *client, const message &m) {
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    std::string method = m.params[0];
+    for (size_t i = 0; i < method.size(); ++i)
+        method[i] = toupper((unsigned char)method[i]);
+    if (method != "DEFLATE") {
+        reply(client, IRCResponse::FAIL(m.command, "UNKNOWN_METHOD", m.params[0],
+                                        "Only DEFLATE is supported"));
+        return;
+    }
+    if (client->compressor || client->kind != Client::user) {
+        reply(client, IRCResponse::FAIL(m.command, "ALREADY_ACTIVE", method,
+                                        "Compression is already on"));
+        return;
+    }
+    send_to(client, ":" + host + " COMPRESS DEFLATE :Compression active");
+    client->compressed += client->output;
+    client->output.clear();
+    client->compressor = new Compressor();
+    charge(client, Client::memory_fixed, COMPRESS_STATE_BYTES);
+    compression.clients++;
+}
+
+void Server::cmd_oper(Client *client, const message &m) {
+    if (m.params.size() < 2) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(target_name(client), m.command));
+        return;
+    }
+    if (oper_password.empty()) {
+        reply(client, IRCResponse::ERR_NOOPERHOST(target_name(client)));
+        return;
+    }
+    if (m.params[0] != oper_name || m.params[1] != oper_password) {
+        reply(client, IRCResponse::ERR_PASSWDMISMATCH(target_name(client)));
+        return;
+    }
+    client->oper = true;
+    forget_who_entries(client);
+    reply(client, IRCResponse::RPL_YOUREOPER(target_name(client)));
+}
+
+// MEMORY [count], for operators: the total charged to clients and the
+// connections holding the most, largest first. Those include links, listed
+// by server name, and clients that have not registered yet.
+void Server::cmd_memory(Client *client, const message &m) {
+    if (!client->oper) {
+        reply(client, IRCResponse::ERR_NOPRIVILEGES(target_name(client)));
+        return;
+    }
+    size_t count = m.params.empty() ? MEMORY_TOP_CLIENTS : atol(m.params[0].c_str());
+    std::vector<std::pair<size_t, Client *> > holders;
+    for (std::map<int, Client *>::iterator it = clients.begin(); it != clients.end(); ++it)
+        holders.push_back(std::make_pair(it->second->memory_total, it->second));
+    count = std::min(count, holders.size());
+    std::partial_sort(holders.begin(), holders.begin() + count, holders.end(),
+                      std::greater<std::pair<size_t, Client *> >());
+
+    // All of it is written before any is queued, which charges client.
+    std::string notice = "NOTICE " + client->get_nickname() + " :";
+    std::vector<std::string> lines;
+    std::ostringstream summary;
+    summary << "Memory: " << memory_counters.used << " bytes in use, peak "
+            << memory_counters.peak << ", budget " << memory_budget << ", "
+            << client_memory_limit << " per user";
+    lines.push_back(notice + summary.str());
+    for (size_t i = 0; i < count; ++i) {
+        Client *holder = holders[i].second;
+        std::string name = holder->kind == Client::link ? holder->server : target_name(holder);
+        std::ostringstream line;
+        line << i + 1 << ". " << name << "@" << holder->get_hostname() << " " << holder->memory_total << " bytes: "
+             << holder->memory[Client::memory_fixed] << " fixed, "
+             << holder->memory[Client::memory_input] << " input, "
+             << holder->memory[Client::memory_output] << " output, "
+             << holder->memory[Client::memory_channels] << " channels";
+        lines.push_back(notice + line.str());
+    }
+    for (size_t i = 0; i < lines.size(); ++i)
+        reply(client, lines[i]);
+}
+
+// LIST, NAMES and WHO are tasks; see Tasks.cpp.
+void Server::cmd_list(Client *client, const message &m) {
+    std::vector<std::string> targets;
+    if (!m.params.empty())
+        targets = split(m.params[0], ',');
+    start_task(client, &Server::list_step, m.command, targets);
+}
+
+void Server::cmd_names(Client *client, const message &m) {
+    if (m.params.empty()) {
+        reply(client, IRCResponse::RPL_ENDOFNAMES(client->get_nickname(), "*"));
+        return;
+    }
+    start_task(client, &Server::names_step, m.command, split(m.params[0], ','));
+}
+
+void Server::cmd_who(Client *client, const message &m) {
+    start_task(client, &Server::who_step, m.command, m.params);
+}
@@ -0,0 +1,54 @@
+#include "Compressor.hpp"
+#include <stdexcept>
+
+// Deflate finds matches in the dictionary like in earlier output, and
+// shorter distances cost fewer bits, so the most common strings come last.
+static const char vocabulary[] =
+	" :No such nick/channel :End of /WHO list. :End of /NAMES list."
+	" 001 002 003 004 005 311 312 318 319 324 329 331 332 333 352 353 366"
+	" 372 375 376 401 403 404 433 442 451 461 482 :is unknown mode char to me"
+	" :Welcome to the ft_irc network :Cannot join channel (+k)"
+	" MODE #channel +b ERROR :Closing Link: KICK TOPIC INVITE WHO WHOIS"
+	" = #channel :@ :Quit: QUIT :Ping timeout :Quit: Leaving\r\n"
+	" PART #channel\r\n JOIN :#channel\r\n :irc.example.net PONG :\r\n"
+	"PING :\r\n NOTICE #channel :\r\n!~user@127.0.0.1 NOTICE \r\n"
+	":nick!user@host PRIVMSG #channel :the a to and is it of for that"
+	" you in this on what with have be :\r\n!user@localhost PRIVMSG #";
+
+Compressor::Compressor(int level, bool primed) {
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	if (deflateInit2(&stream, level, Z_DEFLATED, COMPRESS_WINDOW_BITS,
+			 COMPRESS_MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		throw std::runtime_error("Error: Unable to start a deflate stream.");
+	if (primed) {
+		const std::string &words = dictionary();
+		deflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(words.data()), words.size());
+	}
+}
+
+Compressor::~Compressor() {
+	deflateEnd(&stream);
+}
+
+void Compressor::compress(const char *data, size_t size, std::string &out) {
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	stream.avail_in = size;
+	size_t used = out.size();
+	// Deflate is done once it leaves some of the room unused.
+	do {
+		size_t room = size / 2 + 64;
+		out.resize(used + room);
+		stream.next_out = reinterpret_cast<Bytef *>(&out[used]);
+		stream.avail_out = room;
+		deflate(&stream, Z_SYNC_FLUSH);
+		used += room - stream.avail_out;
+	} while (stream.avail_out == 0);
+	out.resize(used);
+}
+
+const std::string &Compressor::dictionary() {
+	static const std::string words(vocabulary, sizeof(vocabulary) - 1);
+	return words;
+}
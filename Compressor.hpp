@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <zlib.h>
+
+// Deflate stream for one connection's output, after COMPRESS DEFLATE. The
+// server compresses what a client has queued when it flushes, a whole batch
+// of lines at a time, and ends every batch with a sync flush so the client
+// can decode all of it without waiting for more. The stream is in zlib
+// format and primed with dictionary(), a string of common IRC words; its
+// Adler-32 in the zlib header tells the client which dictionary to load.
+// Input from the client is not compressed.
+#define COMPRESS_LEVEL 3
+#define COMPRESS_WINDOW_BITS 15
+#define COMPRESS_MEMORY_LEVEL 8
+// What deflateInit2() allocates with these, by zlib's own formula.
+#define COMPRESS_STATE_BYTES ((1 << (COMPRESS_WINDOW_BITS + 2)) + (1 << (COMPRESS_MEMORY_LEVEL + 9)) + 6 * 1024)
+
+class Compressor {
+	private:
+		z_stream stream;
+
+		Compressor(const Compressor &src);
+		Compressor &operator=(const Compressor &src);
+
+	public:
+		// Without `primed` no dictionary is set, which the benchmark
+		// uses for comparison.
+		explicit Compressor(int level = COMPRESS_LEVEL, bool primed = true);
+		~Compressor();
+		// Compresses size bytes onto the end of out and flushes.
+		void    compress(const char *data, size_t size, std::string &out);
+		static const std::string &dictionary();
+};
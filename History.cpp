@@ -0,0 +1,165 @@
+#include "History.hpp"
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t none = (size_t)-1;
+
+History::History(size_t arena_size)
+    : arena(NULL), newest(none), oldest(none) {
+	size_t count = arena_size / HISTORY_RING_SIZE;
+	if (count == 0)
+		count = 1;
+	arena = static_cast<char *>(malloc(count * HISTORY_RING_SIZE));
+	if (!arena)
+		throw std::runtime_error("Error: Unable to allocate channel history.");
+	rings.resize(count);
+	free_rings.reserve(count);
+	for (size_t i = count; i > 0; i--)
+		free_rings.push_back(i - 1);
+	counters.appended = 0;
+	counters.replayed = 0;
+	counters.dropped = 0;
+	counters.evicted = 0;
+	counters.channels = 0;
+}
+
+History::~History() {
+	free(arena);
+}
+
+char *History::data(size_t index) {
+	return arena + index * HISTORY_RING_SIZE;
+}
+
+void History::unlink(size_t index) {
+	ring &r = rings[index];
+	if (r.newer != none)
+		rings[r.newer].older = r.older;
+	else
+		newest = r.older;
+	if (r.older != none)
+		rings[r.older].newer = r.newer;
+	else
+		oldest = r.newer;
+}
+
+void History::touch(size_t index) {
+	if (newest == index)
+		return;
+	unlink(index);
+	ring &r = rings[index];
+	r.newer = none;
+	r.older = newest;
+	if (newest != none)
+		rings[newest].newer = index;
+	newest = index;
+	if (oldest == none)
+		oldest = index;
+}
+
+// A free ring, or the least recently used one taken from its channel.
+size_t History::take_ring(const std::string &channel) {
+	size_t index;
+	if (!free_rings.empty()) {
+		index = free_rings.back();
+		free_rings.pop_back();
+	} else {
+		index = oldest;
+		unlink(index);
+		channels.erase(rings[index].owner);
+		counters.evicted++;
+	}
+	ring &r = rings[index];
+	r.owner = channels.insert(std::make_pair(channel, index)).first;
+	r.bytes = 0;
+	r.first = 0;
+	r.count = 0;
+	r.newer = none;
+	r.older = newest;
+	if (newest != none)
+		rings[newest].newer = index;
+	newest = index;
+	if (oldest == none)
+		oldest = index;
+	counters.channels = channels.size();
+	return index;
+}
+
+void History::drop_oldest(ring &r) {
+	r.bytes -= r.lines[r.first].size;
+	r.first = (r.first + 1) % HISTORY_LINES;
+	r.count--;
+	counters.dropped++;
+}
+
+// Copies text into the ring at `at`, wrapping at its end.
+void History::copy_in(size_t index, size_t at, const char *text, size_t size) {
+	char *bytes = data(index);
+	size_t head = HISTORY_RING_SIZE - at;
+	if (size <= head) {
+		memcpy(bytes + at, text, size);
+	} else {
+		memcpy(bytes + at, text, head);
+		memcpy(bytes, text + head, size - head);
+	}
+}
+
+void History::append(const std::string &channel, const std::string &text) {
+	size_t size = text.size() + 2;
+	if (size > HISTORY_RING_SIZE)
+		return;
+	size_t index;
+	ring_map::iterator it = channels.find(channel);
+	if (it == channels.end()) {
+		index = take_ring(channel);
+	} else {
+		index = it->second;
+		touch(index);
+	}
+	ring &r = rings[index];
+	while (r.count == HISTORY_LINES || HISTORY_RING_SIZE - r.bytes < size)
+		drop_oldest(r);
+
+	size_t start = r.count ? (r.lines[r.first].offset + r.bytes) % HISTORY_RING_SIZE : 0;
+	copy_in(index, start, text.data(), text.size());
+	copy_in(index, (start + text.size()) % HISTORY_RING_SIZE, "\r\n", 2);
+	line &l = r.lines[(r.first + r.count) % HISTORY_LINES];
+	l.offset = start;
+	l.size = size;
+	r.count++;
+	r.bytes += size;
+	counters.appended++;
+}
+
+size_t History::replay(const std::string &channel, size_t limit, std::string &out) {
+	ring_map::iterator it = channels.find(channel);
+	if (it == channels.end())
+		return 0;
+	size_t index = it->second;
+	touch(index);
+	ring &r = rings[index];
+	size_t count = limit < r.count ? limit : r.count;
+	const char *bytes = data(index);
+	for (size_t i = r.count - count; i < r.count; i++) {
+		const line &l = r.lines[(r.first + i) % HISTORY_LINES];
+		size_t head = HISTORY_RING_SIZE - l.offset;
+		if (l.size <= head) {
+			out.append(bytes + l.offset, l.size);
+		} else {
+			out.append(bytes + l.offset, head);
+			out.append(bytes, l.size - head);
+		}
+	}
+	counters.replayed += count;
+	return count;
+}
+
+size_t History::size(const std::string &channel) const {
+	ring_map::const_iterator it = channels.find(channel);
+	return it == channels.end() ? 0 : rings[it->second].count;
+}
+
+const History::stats &History::get_stats() const {
+	return counters;
+}
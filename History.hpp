@@ -0,0 +1,83 @@
+#pragma once
+
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Recent channel messages, kept as the serialized lines that went out
+// (terminator included) so replaying them is a copy into the client's
+// output. The arena is allocated once and cut into HISTORY_RING_SIZE rings;
+// a channel gets a ring on its first message and keeps its last
+// HISTORY_LINES lines there, dropping the oldest when the ring is full.
+// Rings are not tied to Channel objects, so history outlives a channel
+// everyone left. When all rings are taken the one written or read least
+// recently is handed to the new channel.
+#define HISTORY_ARENA_SIZE (4 << 20)
+#define HISTORY_RING_SIZE (16 << 10)
+#define HISTORY_LINES 64
+// Lines replayed to a client joining a channel.
+#define HISTORY_JOIN_LINES 20
+
+class History {
+	public:
+		struct stats {
+			unsigned long appended;
+			unsigned long replayed;
+			unsigned long dropped;   // Pushed out of a full ring.
+			unsigned long evicted;   // Channels that lost their ring.
+			size_t        channels;
+		};
+
+	private:
+		struct line {
+			uint16_t offset;
+			uint16_t size;
+		};
+
+		typedef std::map<std::string, size_t> ring_map;
+
+		struct ring {
+			ring_map::iterator owner;
+			// Byte ring: the oldest line starts at lines[first].offset
+			// and `bytes` bytes follow it, wrapping at the end.
+			size_t    bytes;
+			unsigned  first;
+			unsigned  count;
+			line      lines[HISTORY_LINES];
+			// Least recently used order, most recent first.
+			size_t    newer;
+			size_t    older;
+		};
+
+		char                *arena;
+		std::vector<ring>   rings;
+		std::vector<size_t> free_rings;
+		ring_map            channels;
+		size_t              newest;
+		size_t              oldest;
+		stats               counters;
+
+		History(const History &src);
+		History &operator=(const History &src);
+		char    *data(size_t index);
+		void    unlink(size_t index);
+		void    touch(size_t index);
+		size_t  take_ring(const std::string &channel);
+		void    drop_oldest(ring &r);
+		void    copy_in(size_t index, size_t at, const char *text, size_t size);
+
+	public:
+		// arena_size is split into rings of HISTORY_RING_SIZE bytes.
+		explicit History(size_t arena_size);
+		~History();
+		// Keeps text followed by \r\n. Lines longer than a ring are not
+		// kept.
+		void    append(const std::string &channel, const std::string &text);
+		// Appends the last `limit` lines of channel to out, oldest first.
+		// Returns the number of lines.
+		size_t  replay(const std::string &channel, size_t limit, std::string &out);
+		size_t  size(const std::string &channel) const;
+		const stats &get_stats() const;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <ctime>
 
@@ -45,8 +46,14 @@ public:
     static std::string ERR_CANNOTSENDTOCHAN(const std::string& source, const std::string& channel) {
         return "404 " + source + " " + channel + " :Cannot send to channel";
     }
-    static std::string ERR_CHANOPRIVSNEEDED(const std::string& source, const std::string& channel) {
-        return "482 " + source + " " + channel + " :You're not channel operator";
+    static std::string ERR_BANNEDFROMCHAN(const std::string& source, const std::string& channel) {
+        return "474 " + source + " " + channel + " :Cannot join channel (+b)";
+    }
+    static std::string ERR_UNKNOWNMODE(const std::string& source, char mode) {
+        return "472 " + source + " " + std::string(1, mode) + " :is unknown mode char to me";
+    }
+    static std::string ERR_YOUREBANNEDCREEP(const std::string& source) {
+        return "465 " + source + " :You are banned from this server";
     }
     static std::string ERR_CHANOPRIVSNEEDED(const std::string& source, const std::string& channel) {
         return "482 " + source + " " + channel + " :You're not channel operator";
@@ -54,19 +61,77 @@ public:
     static std::string ERR_NOSUCHNICK(const std::string& source, const std::string& nickname) {
         return "401 " + source + " " + nickname + " :No such nick/channel";
     }
+    static std::string ERR_NOSUCHSERVER(const std::string& source, const std::string& server) {
+        return "402 " + source + " " + server + " :No such server";
+    }
+    static std::string ERR_INVALIDCAPCMD(const std::string& source, const std::string& command) {
+        return "410 " + source + " " + command + " :Invalid CAP command";
+    }
+    static std::string ERR_NOPRIVILEGES(const std::string& source) {
+        return "481 " + source + " :Permission Denied- You're not an IRC operator";
+    }
+    static std::string ERR_NOOPERHOST(const std::string& source) {
+        return "491 " + source + " :No O-lines for your host";
+    }
     static std::string ERR_USERNOTINCHANNEL(const std::string& source, const std::string& nickname, const std::string& channel) {
         return "441 " + source + " " + nickname + " " + channel + " :They aren't on that channel";
     }
+    // IRCv3 standard replies.
+    static std::string FAIL(const std::string& command, const std::string& code, const std::string& context, const std::string& description) {
+        return "FAIL " + command + " " + code + " " + context + " :" + description;
+    }
     /* Numeric Responses */
     static std::string RPL_WELCOME(const std::string& source) {
         return "001 " + source + " :Welcome " + source + " to the ft_irc network";
     }
+    static std::string RPL_YOUREOPER(const std::string& source) {
+        return "381 " + source + " :You are now an IRC operator";
+    }
+    static std::string RPL_TRYAGAIN(const std::string& source, const std::string& command) {
+        return "263 " + source + " " + command + " :Please wait a while and try again.";
+    }
+    // 322 and 352 without the "322 <source> " in front: the server keeps
+    // this part per channel and member and adds the rest for each request.
+    static std::string RPL_LIST(const std::string& channel, size_t visible) {
+        std::ostringstream line;
+        line << channel << " " << visible << " :";
+        return line.str();
+    }
+    static std::string RPL_LISTEND(const std::string& source) {
+        return "323 " + source + " :End of LIST";
+    }
+    static std::string RPL_WHOREPLY(const std::string& channel, const std::string& user, const std::string& host,
+                                    const std::string& server, const std::string& nickname,
+                                    const std::string& flags, unsigned hops, const std::string& realname) {
+        std::ostringstream line;
+        line << channel << " " << user << " " << host << " " << server << " " << nickname << " "
+             << flags << " :" << hops << " " << realname;
+        return line.str();
+    }
+    static std::string RPL_ENDOFWHO(const std::string& source, const std::string& mask) {
+        return "315 " + source + " " + mask + " :End of WHO list";
+    }
     static std::string RPL_NAMREPLY(const std::string& source, const std::string& channel, const std::string& users) {
         return "353 " + source + " = " + channel + " :" + users;
     }
     static std::string RPL_ENDOFNAMES(const std::string& source, const std::string& channel) {
         return "366 " + source + " " + channel + " :End of /NAMES list.";
     }    
+    static std::string RPL_CHANNELMODEIS(const std::string& source, const std::string& channel, const std::string& modes) {
+        return "324 " + source + " " + channel + " " + modes;
+    }
+    static std::string RPL_BANLIST(const std::string& source, const std::string& channel, const std::string& mask) {
+        return "367 " + source + " " + channel + " " + mask;
+    }
+    static std::string RPL_ENDOFBANLIST(const std::string& source, const std::string& channel) {
+        return "368 " + source + " " + channel + " :End of channel ban list";
+    }
+    static std::string RPL_INVITELIST(const std::string& source, const std::string& channel, const std::string& mask) {
+        return "346 " + source + " " + channel + " " + mask;
+    }
+    static std::string RPL_ENDOFINVITELIST(const std::string& source, const std::string& channel) {
+        return "347 " + source + " " + channel + " :End of channel invite exception list";
+    }
     /* Command Responses */   
     static std::string RPL_JOIN(const std::string& source, const std::string& channel) {
         return ":" + source + " JOIN :" + channel;
@@ -0,0 +1,585 @@
+#include "Server.hpp"
+#include "IRCResponse.hpp"
+#include "Text.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+// Server links, loosely after RFC 2813. Both ends of a link send
+//
+//	PASS <password>
+//	SERVER <name> 1 :<description>
+//
+// and once each has accepted the other's, a burst of the network as seen
+// from its side: SERVER for every server behind it, NICK for every user,
+// NJOIN with the members of every channel and MODE for channel keys, bans
+// and invite exceptions. The burst is built in one buffer and queued as a
+// whole, so it goes out in a few large writes instead of a line at a time.
+//
+// After that, changes travel to every other link as they happen. NICK,
+// QUIT, JOIN, PART and MODE are sent as users see them, with the user's
+// nick!user@host prefix; PRIVMSG and NOTICE to a channel only go to links
+// with members on it. Users are introduced with
+//
+//	NICK <nick> <hops> <user> <host> <server> + :<realname>
+//
+// which has the server's name where RFC 2813 has a token. Without
+// timestamps, a nick known on both sides of a new link is killed on both.
+// When a link closes its users quit with "<this server> <peer>" as the
+// reason, the way clients recognise a netsplit, and the other links get an
+// SQUIT for every server lost.
+
+static const char *description = "ft_irc server";
+
+static std::string number(unsigned long n) {
+    std::ostringstream stream;
+    stream << n;
+    return stream.str();
+}
+
+void Server::set_name(const std::string &name) {
+    host = name;
+}
+
+void Server::load_links(const std::string &path) {
+    std::ifstream file(path.c_str());
+    if (!file)
+        throw std::runtime_error("Error: Unable to open the link file " + path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        link_config config;
+        std::string flag;
+        if (!(fields >> config.name >> config.address >> config.port >> config.password))
+            throw std::runtime_error("Error: Bad link line: " + line);
+        config.autoconnect = (fields >> flag) && flag == "autoconnect";
+        link_configs[config.name] = config;
+    }
+}
+
+const link_stats &Server::get_link_stats() const {
+    return link_counters;
+}
+
+// Connects without waiting: the handshake is queued and goes out once the
+// socket is writable. A refused connection shows up as an error on it.
+void Server::connect_link(const link_config &config) {
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *address;
+    if (getaddrinfo(config.address.c_str(), config.port.c_str(), &hints, &address) != 0)
+        throw std::runtime_error("Error: Unable to resolve " + config.address);
+    int fd = socket(address->ai_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        freeaddrinfo(address);
+        throw std::runtime_error("Error: Unable to open a socket for " + config.name);
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    int connected = connect(fd, address->ai_addr, address->ai_addrlen);
+    freeaddrinfo(address);
+    if (connected < 0 && errno != EINPROGRESS) {
+        close(fd);
+        throw std::runtime_error("Error: Unable to connect to " + config.name + ": " + strerror(errno));
+    }
+    Client *link = add_client(fd, atoi(config.port.c_str()), config.address);
+    connecting[fd] = config.name;
+    if (uring)
+        uring->watch(fd);
+    send_handshake(link, config);
+}
+
+void Server::send_handshake(Client *link, const link_config &config) {
+    send_to(link, "PASS " + config.password);
+    send_to(link, "SERVER " + host + " 1 :" + description);
+}
+
+std::string Server::introduction(Client *user, unsigned hops) const {
+    return "NICK " + user->get_nickname() + " " + number(hops) + " " + user->get_username()
+        + " " + user->get_hostname() + " " + (user->kind == Client::user ? host : user->server)
+        + " + :" + user->get_realname();
+}
+
+void Server::send_burst(Client *link) {
+    std::string burst;
+    unsigned long lines = 0;
+    std::string prefix = ":" + host + " ";
+
+    for (std::map<std::string, server_info>::iterator it = servers.begin(); it != servers.end(); ++it) {
+        if (it->second.via == link)
+            continue;
+        burst += prefix + "SERVER " + it->first + " " + number(it->second.hops + 1)
+            + " :" + it->second.description + "\r\n";
+        lines++;
+    }
+    for (std::map<std::string, Client *>::iterator it = nicknames.begin(); it != nicknames.end(); ++it) {
+        Client *user = it->second;
+        if (!user->is_registered() || user->kind == Client::link || user->via == link)
+            continue;
+        unsigned hops = user->kind == Client::user ? 1 : servers[user->server].hops + 1;
+        burst += introduction(user, hops) + "\r\n";
+        lines++;
+    }
+    for (std::map<std::string, Channel *>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        Channel *channel = it->second;
+        const std::vector<Client *> &members = channel->get_clients();
+        // Member lists are cut so lines stay well under 512 bytes.
+        std::string start = prefix + "NJOIN " + channel->get_name() + " :";
+        std::string list;
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i]->via == link)
+                continue;
+            if (!list.empty())
+                list += ",";
+            if (members[i] == channel->get_admin())
+                list += "@";
+            list += members[i]->get_nickname();
+            if (start.size() + list.size() > 400) {
+                burst += start + list + "\r\n";
+                lines++;
+                list.clear();
+            }
+        }
+        if (!list.empty()) {
+            burst += start + list + "\r\n";
+            lines++;
+        }
+        std::string mode = prefix + "MODE " + it->first + " ";
+        if (!channel->get_key().empty()) {
+            burst += mode + "+k " + channel->get_key() + "\r\n";
+            lines++;
+        }
+        for (int list_index = 0; list_index < 2; ++list_index) {
+            const MaskSet &masks = list_index ? channel->invite_exceptions : channel->bans;
+            for (size_t i = 0; i < masks.get_masks().size(); ++i) {
+                burst += mode + (list_index ? "+I " : "+b ") + masks.get_masks()[i] + "\r\n";
+                lines++;
+            }
+        }
+    }
+
+    if (burst.empty())
+        return;
+    if (link->output.empty())
+        output_ready.push_back(link->get_fd());
+    link->output += burst;
+    output_bytes += burst.size();
+    charge(link, Client::memory_output, burst.size());
+    link_counters.bursts++;
+    link_counters.burst_lines += lines;
+    link_counters.link_lines += lines;
+    link_counters.burst_bytes += burst.size();
+}
+
+// To every link but `except`.
+void Server::propagate(const std::string &line, Client *except) {
+    for (std::map<std::string, server_info>::iterator it = servers.begin(); it != servers.end(); ++it) {
+        if (it->second.hops == 1 && it->second.via != except)
+            send_to(it->second.via, line);
+    }
+}
+
+// To every link with members on channel, once each, but not back to the
+// link `except` came from. Links form a tree, so each server gets the line
+// exactly once and hands it on the same way. Like everything else queued
+// to a link, it goes out with the rest of the iteration's lines in one
+// write when the loop flushes.
+void Server::relay(Channel *channel, const std::string &line, Client *except) {
+    const std::vector<std::pair<Client *, unsigned> > &links = channel->get_links();
+    Client *from = except && except->kind == Client::remote_user ? except->via : except;
+    for (size_t i = 0; i < links.size(); ++i) {
+        if (links[i].first == from)
+            continue;
+        send_to(links[i].first, line);
+        link_counters.relayed++;
+        link_counters.relay_bytes_saved += (links[i].second - 1) * (line.size() + 2);
+    }
+}
+
+// The remote user a link message comes from. Messages naming a user that
+// is not behind that link are dropped.
+Client *Server::remote_source(Client *link, const message &m) {
+    std::string nickname = m.prefix.substr(0, m.prefix.find('!'));
+    std::map<std::string, Client *>::iterator it = nicknames.find(fold_name(nickname));
+    if (it == nicknames.end() || it->second->via != link)
+        return NULL;
+    return it->second;
+}
+
+void Server::remove_remote_user(Client *user, const std::string &quit) {
+    notify_peers(user, quit);
+    while (!user->channels.empty())
+        part_channel(user, channels[*user->channels.begin()]);
+    std::map<std::string, Client *>::iterator it = nicknames.find(fold_name(user->get_nickname()));
+    if (it != nicknames.end() && it->second == user)
+        nicknames.erase(it);
+    memory_counters.used -= user->memory_total;
+    delete user;
+}
+
+// Local users are closed at the end of the loop iteration, remote ones are
+// removed here and the KILL goes on towards their server.
+void Server::kill_user(Client *user, const std::string &reason) {
+    if (user->kind == Client::user) {
+        user->set_quitting("Killed (" + host + " (" + reason + "))");
+        flush_client(user);
+        close_client(user);
+        return;
+    }
+    send_to(user->via, "KILL " + user->get_nickname() + " :" + reason);
+    std::string quit = ":" + user->get_source() + " QUIT :Killed (" + reason + ")";
+    Client *via = user->via;
+    remove_remote_user(user, quit);
+    propagate(quit, via);
+}
+
+void Server::split_servers(Client *link, const std::vector<std::string> &names, const std::string &reason) {
+    std::vector<Client *> lost;
+    for (std::map<std::string, Client *>::iterator it = nicknames.begin(); it != nicknames.end(); ++it) {
+        Client *user = it->second;
+        if (user->kind == Client::remote_user
+            && std::find(names.begin(), names.end(), user->server) != names.end())
+            lost.push_back(user);
+    }
+    for (size_t i = 0; i < lost.size(); ++i)
+        remove_remote_user(lost[i], ":" + lost[i]->get_source() + " QUIT :" + reason);
+    for (size_t i = 0; i < names.size(); ++i) {
+        servers.erase(names[i]);
+        propagate(":" + host + " SQUIT " + names[i] + " :" + reason, link);
+    }
+    link_counters.split_users += lost.size();
+}
+
+// The link is closing: everything behind it is gone.
+void Server::netsplit(Client *link) {
+    connecting.erase(link->get_fd());
+    if (link->server.empty())
+        return;
+    std::vector<std::string> names;
+    for (std::map<std::string, server_info>::iterator it = servers.begin(); it != servers.end(); ++it) {
+        if (it->second.via == link)
+            names.push_back(it->first);
+    }
+    std::cout << "Lost the link to " << link->server << std::endl;
+    split_servers(link, names, host + " " + link->server);
+    link_counters.netsplits++;
+}
+
+// Returns whether the channel was created.
+bool Server::join_remote(Client *user, const std::string &name) {
+    Channel *channel;
+    bool created = false;
+    std::string folded = fold_name(name);
+    std::map<std::string, Channel *>::iterator it = channels.find(folded);
+    if (it == channels.end()) {
+        channel = new Channel(name, "", user);
+        channels[folded] = channel;
+        created = true;
+    } else {
+        channel = it->second;
+        if (channel->has_client(user))
+            return false;
+    }
+    channel->add_client(user);
+    user->channels.insert(folded);
+    charge(user, Client::memory_channels, MEMBERSHIP_BYTES + folded.size());
+    broadcast(channel, IRCResponse::RPL_JOIN(user->get_source(), channel->get_name()), user);
+    return created;
+}
+
+void Server::cmd_server(Client *client, const message &m) {
+    if (client->is_registered()) {
+        reply(client, IRCResponse::ERR_ALREADYREGISTERED(client->get_nickname()));
+        return;
+    }
+    if (m.params.size() < 2) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS("*", m.command));
+        return;
+    }
+    const std::string &name = m.params[0];
+    std::map<std::string, link_config>::iterator config = link_configs.find(name);
+    std::map<int, std::string>::iterator outgoing = connecting.find(client->get_fd());
+    const char *error = NULL;
+    if (config == link_configs.end() || client->get_password() != config->second.password)
+        error = "ERROR :Bad password or unknown server";
+    else if (name == host || servers.count(name))
+        error = "ERROR :Server already exists";
+    else if (outgoing != connecting.end() && outgoing->second != name)
+        error = "ERROR :Expected another server";
+    if (error) {
+        send_to(client, error);
+        client->set_quitting("Link refused");
+        return;
+    }
+
+    if (outgoing == connecting.end())
+        send_handshake(client, config->second);
+    else
+        connecting.erase(outgoing);
+    std::map<std::string, Client *>::iterator nick = nicknames.find(fold_name(client->get_nickname()));
+    if (nick != nicknames.end() && nick->second == client)
+        nicknames.erase(nick);
+    client->kind = Client::link;
+    client->server = name;
+    server_info info = {client, 1, m.params.size() > 2 ? m.params.back() : ""};
+    servers[name] = info;
+    propagate(":" + host + " SERVER " + name + " 2 :" + info.description, client);
+    send_burst(client);
+    std::cout << "Linked with " << name << std::endl;
+}
+
+void Server::cmd_connect(Client *client, const message &m) {
+    if (!client->oper) {
+        reply(client, IRCResponse::ERR_NOPRIVILEGES(client->get_nickname()));
+        return;
+    }
+    if (m.params.empty()) {
+        reply(client, IRCResponse::ERR_NEEDMOREPARAMS(client->get_nickname(), m.command));
+        return;
+    }
+    const std::string &name = m.params[0];
+    std::map<std::string, link_config>::iterator config = link_configs.find(name);
+    if (config == link_configs.end()) {
+        reply(client, IRCResponse::ERR_NOSUCHSERVER(client->get_nickname(), name));
+        return;
+    }
+    bool pending = false;
+    for (std::map<int, std::string>::iterator it = connecting.begin(); it != connecting.end(); ++it)
+        pending = pending || it->second == name;
+    if (servers.count(name) || pending) {
+        reply(client, "NOTICE " + client->get_nickname() + " :Already linked with " + name);
+        return;
+    }
+    try {
+        connect_link(config->second);
+        reply(client, "NOTICE " + client->get_nickname() + " :Connecting to " + name);
+    } catch (const std::exception &e) {
+        reply(client, "NOTICE " + client->get_nickname() + " :" + e.what());
+    }
+}
+
+void Server::dispatch_link(Client *link, message &m) {
+    std::map<std::string, command_handler>::iterator it = link_commands.find(m.command);
+    if (it != link_commands.end())
+        (this->*it->second)(link, m);
+}
+
+void Server::link_ping(Client *link, const message &m) {
+    send_to(link, ":" + host + " PONG " + host + " :" + (m.params.empty() ? host : m.params[0]));
+}
+
+void Server::link_error(Client *link, const message &m) {
+    std::cout << "Link " << link->server << " closing: " << (m.params.empty() ? "" : m.params[0]) << std::endl;
+    link->set_quitting("Link error");
+}
+
+// :<uplink> SERVER <name> <hops> :<description>
+void Server::link_server(Client *link, const message &m) {
+    if (m.params.size() < 2)
+        return;
+    const std::string &name = m.params[0];
+    if (name == host || servers.count(name)) {
+        // Two paths to one server: this link closes the loop.
+        send_to(link, "ERROR :Server " + name + " already exists");
+        link->set_quitting("Server " + name + " already exists");
+        return;
+    }
+    server_info info = {link, (unsigned)atoi(m.params[1].c_str()), m.params.size() > 2 ? m.params.back() : ""};
+    servers[name] = info;
+    propagate(":" + host + " SERVER " + name + " " + number(info.hops + 1) + " :" + info.description, link);
+}
+
+// SQUIT <server> :<reason>
+void Server::link_squit(Client *link, const message &m) {
+    if (m.params.empty())
+        return;
+    std::map<std::string, server_info>::iterator it = servers.find(m.params[0]);
+    if (it == servers.end() || it->second.via != link || it->second.hops == 1)
+        return;
+    split_servers(link, std::vector<std::string>(1, m.params[0]),
+                  m.params.size() > 1 ? m.params[1] : host + " " + m.params[0]);
+}
+
+// A new user (7 parameters) or a nick change (a prefix and one parameter).
+void Server::link_nick(Client *link, const message &m) {
+    if (m.params.size() >= 7) {
+        const std::string &nickname = m.params[0];
+        std::map<std::string, Client *>::iterator taken = nicknames.find(fold_name(nickname));
+        if (taken != nicknames.end()) {
+            kill_user(taken->second, "Nick collision");
+            send_to(link, "KILL " + nickname + " :Nick collision");
+            return;
+        }
+        Client *user = new Client(-1, 0, m.params[3]);
+        user->set_nickname(nickname);
+        user->set_user(m.params[2], m.params[6]);
+        user->set_registered();
+        user->kind = Client::remote_user;
+        user->server = m.params[4];
+        user->via = link;
+        charge(user, Client::memory_fixed, sizeof(Client));
+        nicknames[fold_name(nickname)] = user;
+        unsigned hops = atoi(m.params[1].c_str());
+        propagate(introduction(user, hops + 1), link);
+        return;
+    }
+    Client *user = remote_source(link, m);
+    if (!user || m.params.empty())
+        return;
+    const std::string &nickname = m.params[0];
+    std::string folded = fold_name(nickname);
+    std::map<std::string, Client *>::iterator taken = nicknames.find(folded);
+    if (taken != nicknames.end() && taken->second != user) {
+        kill_user(user, "Nick collision");
+        return;
+    }
+    std::string line = ":" + user->get_source() + " NICK :" + nickname;
+    notify_peers(user, line);
+    nicknames.erase(fold_name(user->get_nickname()));
+    nicknames[folded] = user;
+    user->set_nickname(nickname);
+    forget_who_entries(user);
+    propagate(line, link);
+}
+
+void Server::link_quit(Client *link, const message &m) {
+    Client *user = remote_source(link, m);
+    if (!user)
+        return;
+    std::string quit = ":" + user->get_source() + " QUIT :" + (m.params.empty() ? "" : m.params[0]);
+    remove_remote_user(user, quit);
+    propagate(quit, link);
+}
+
+// KILL <nick> :<reason>, for a user this side introduced.
+void Server::link_kill(Client *link, const message &m) {
+    if (m.params.empty())
+        return;
+    std::map<std::string, Client *>::iterator it = nicknames.find(fold_name(m.params[0]));
+    if (it == nicknames.end() || it->second->via == link || it->second->kind == Client::link)
+        return;
+    kill_user(it->second, m.params.size() > 1 ? m.params[1] : "Killed");
+}
+
+// :<user> JOIN <channel> [key]; the key comes with the JOIN that created
+// the channel.
+void Server::link_join(Client *link, const message &m) {
+    Client *user = remote_source(link, m);
+    if (!user || m.params.empty())
+        return;
+    const std::string &name = m.params[0];
+    if (join_remote(user, name) && m.params.size() > 1)
+        channels[fold_name(name)]->set_key(m.params[1]);
+    std::string line = ":" + user->get_source() + " JOIN " + name;
+    if (m.params.size() > 1)
+        line += " " + m.params[1];
+    propagate(line, link);
+}
+
+// NJOIN <channel> :[@]<nick>,[@]<nick>...
+void Server::link_njoin(Client *link, const message &m) {
+    if (m.params.size() < 2)
+        return;
+    const std::string &name = m.params[0];
+    std::string joined;
+    std::istringstream list(m.params[1]);
+    std::string member;
+    while (std::getline(list, member, ',')) {
+        if (member.empty())
+            continue;
+        std::string nickname = member[0] == '@' ? member.substr(1) : member;
+        std::map<std::string, Client *>::iterator it = nicknames.find(fold_name(nickname));
+        if (it == nicknames.end() || it->second->via != link)
+            continue;
+        join_remote(it->second, name);
+        if (!joined.empty())
+            joined += ",";
+        joined += member;
+    }
+    if (!joined.empty())
+        propagate(":" + host + " NJOIN " + name + " :" + joined, link);
+}
+
+void Server::link_part(Client *link, const message &m) {
+    Client *user = remote_source(link, m);
+    if (!user || m.params.empty())
+        return;
+    std::map<std::string, Channel *>::iterator it = channels.find(fold_name(m.params[0]));
+    if (it == channels.end() || !it->second->has_client(user))
+        return;
+    std::string line = IRCResponse::RPL_PART(user->get_source(), m.params[0]);
+    broadcast(it->second, line, user);
+    part_channel(user, it->second);
+    propagate(line, link);
+}
+
+// PRIVMSG and NOTICE, to a channel or to a user on this side.
+void Server::link_text(Client *link, const message &m) {
+    Client *user = remote_source(link, m);
+    if (!user || m.params.size() < 2 || m.params[0].empty())
+        return;
+    const std::string &target = m.params[0];
+    std::string line = ":" + user->get_source() + " " + m.command + " " + target + " :" + m.params[1];
+    if (target[0] == '#' || target[0] == '&') {
+        std::map<std::string, Channel *>::iterator it = channels.find(fold_name(target));
+        if (it == channels.end())
+            return;
+        broadcast(it->second, line, user);
+        relay(it->second, line, user);
+        history.append(it->first, line);
+        return;
+    }
+    std::map<std::string, Client *>::iterator it = nicknames.find(fold_name(target));
+    if (it == nicknames.end() || it->second->via == link)
+        return;
+    send_to(it->second->via ? it->second->via : it->second, line);
+}
+
+// Channel modes from a user or, in a burst, from a server: +b, +I and +k.
+void Server::link_mode(Client *link, const message &m) {
+    if (m.params.size() < 2)
+        return;
+    std::map<std::string, Channel *>::iterator it = channels.find(fold_name(m.params[0]));
+    if (it == channels.end())
+        return;
+    Client *user = remote_source(link, m);
+    if (!user && !servers.count(m.prefix) && m.prefix != link->server)
+        return;
+    Channel *channel = it->second;
+    const std::string &modes = m.params[1];
+    size_t next_param = 2;
+    bool adding = true;
+    for (size_t i = 0; i < modes.size(); ++i) {
+        char mode = modes[i];
+        if (mode == '+' || mode == '-') {
+            adding = mode == '+';
+            continue;
+        }
+        if (mode == 'k') {
+            if (!adding)
+                channel->set_key("");
+            else if (next_param < m.params.size())
+                channel->set_key(m.params[next_param]);
+            next_param += adding;
+            continue;
+        }
+        if ((mode != 'b' && mode != 'I') || next_param >= m.params.size())
+            continue;
+        MaskSet &list = mode == 'b' ? channel->bans : channel->invite_exceptions;
+        const std::string &mask = m.params[next_param++];
+        if (adding)
+            list.add(mask);
+        else
+            list.remove(mask);
+    }
+    std::string args;
+    for (size_t i = 2; i < m.params.size(); ++i)
+        args += (i > 2 ? " " : "") + m.params[i];
+    std::string line = IRCResponse::RPL_MODE(user ? user->get_source() : m.prefix,
+                                             m.params[0], modes, args);
+    broadcast(channel, line, user);
+    propagate(line, link);
+}
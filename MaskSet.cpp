@@ -0,0 +1,234 @@
+#include "MaskSet.hpp"
+#include "Text.hpp"
+#include <deque>
+
+std::string MaskSet::casefold(const std::string &s) {
+	return fold_name(s);
+}
+
+bool MaskSet::match(const std::string &mask, const std::string &subject) {
+	std::string m = casefold(mask), s = casefold(subject);
+	size_t mi = 0, si = 0, star = std::string::npos, resume = 0;
+	while (si < s.size()) {
+		if (mi < m.size() && (m[mi] == '?' || m[mi] == s[si])) {
+			mi++;
+			si++;
+		} else if (mi < m.size() && m[mi] == '*') {
+			star = mi++;
+			resume = si;
+		} else if (star != std::string::npos) {
+			mi = star + 1;
+			si = ++resume;
+		} else {
+			return false;
+		}
+	}
+	while (mi < m.size() && m[mi] == '*')
+		mi++;
+	return mi == m.size();
+}
+
+MaskSet::MaskSet() : stale(true) {
+}
+
+bool MaskSet::add(const std::string &mask) {
+	std::string f = casefold(mask);
+	for (size_t i = 0; i < folded.size(); i++) {
+		if (folded[i] == f)
+			return false;
+	}
+	masks.push_back(mask);
+	folded.push_back(f);
+	patterns.push_back(make_pattern(f));
+	stale = true;
+	return true;
+}
+
+bool MaskSet::remove(const std::string &mask) {
+	std::string f = casefold(mask);
+	for (size_t i = 0; i < folded.size(); i++) {
+		if (folded[i] == f) {
+			masks.erase(masks.begin() + i);
+			folded.erase(folded.begin() + i);
+			patterns.erase(patterns.begin() + i);
+			stale = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+void MaskSet::clear() {
+	masks.clear();
+	folded.clear();
+	patterns.clear();
+	stale = true;
+}
+
+const std::vector<std::string> &MaskSet::get_masks() const {
+	return masks;
+}
+
+size_t MaskSet::size() const {
+	return masks.size();
+}
+
+MaskSet::pattern MaskSet::make_pattern(const std::string &f) {
+	pattern p;
+	p.star = f.find('*') != std::string::npos;
+	p.star_start = !f.empty() && f[0] == '*';
+	p.star_end = !f.empty() && f[f.size() - 1] == '*';
+	p.min_size = 0;
+	size_t start = 0;
+	while (start <= f.size()) {
+		size_t end = f.find('*', start);
+		if (end == std::string::npos)
+			end = f.size();
+		if (end > start || !p.star) {
+			p.segments.push_back(f.substr(start, end - start));
+			p.min_size += end - start;
+		}
+		start = end + 1;
+	}
+	return p;
+}
+
+std::string MaskSet::key_of(const std::string &f) {
+	size_t best = 0, best_size = 0, start = 0;
+	while (start < f.size()) {
+		size_t end = f.find_first_of("*?", start);
+		if (end == std::string::npos)
+			end = f.size();
+		if (end - start > best_size) {
+			best = start;
+			best_size = end - start;
+		}
+		start = end + 1;
+	}
+	return f.substr(best, best_size);
+}
+
+static bool segment_at(const std::string &segment, const char *s) {
+	for (size_t i = 0; i < segment.size(); i++) {
+		if (segment[i] != '?' && segment[i] != s[i])
+			return false;
+	}
+	return true;
+}
+
+// `subject` is folded already. Segments between stars have a fixed length,
+// so taking the leftmost place for each in turn never misses a match.
+bool MaskSet::match_pattern(const pattern &p, const std::string &subject) {
+	size_t size = subject.size();
+	const char *s = subject.data();
+	if (size < p.min_size)
+		return false;
+	if (!p.star)
+		return size == p.min_size && segment_at(p.segments[0], s);
+
+	size_t first = 0, last = p.segments.size();
+	size_t begin = 0, end = size;
+	if (!p.star_start) {
+		if (!segment_at(p.segments[0], s))
+			return false;
+		begin = p.segments[0].size();
+		first++;
+	}
+	if (!p.star_end) {
+		const std::string &segment = p.segments[last - 1];
+		if (!segment_at(segment, s + size - segment.size()))
+			return false;
+		end -= segment.size();
+		last--;
+	}
+	for (size_t i = first; i < last; i++) {
+		const std::string &segment = p.segments[i];
+		while (begin + segment.size() <= end && !segment_at(segment, s + begin))
+			begin++;
+		if (begin + segment.size() > end)
+			return false;
+		begin += segment.size();
+	}
+	return true;
+}
+
+void MaskSet::compile() const {
+	states.assign(1, state());
+	states[0].fail = 0;
+	states[0].output = 0;
+	unkeyed.clear();
+	for (size_t i = 0; i < folded.size(); i++) {
+		std::string key = key_of(folded[i]);
+		if (key.empty()) {
+			unkeyed.push_back(i);
+			continue;
+		}
+		size_t at = 0;
+		for (size_t j = 0; j < key.size(); j++) {
+			std::map<char, size_t>::iterator it = states[at].next.find(key[j]);
+			if (it == states[at].next.end()) {
+				states.push_back(state());
+				states[at].next[key[j]] = states.size() - 1;
+				at = states.size() - 1;
+			} else {
+				at = it->second;
+			}
+		}
+		states[at].patterns.push_back(i);
+	}
+
+	// Fail links, breadth first: the longest proper suffix of a state's
+	// string that is also in the trie.
+	std::deque<size_t> queue;
+	for (std::map<char, size_t>::iterator it = states[0].next.begin(); it != states[0].next.end(); ++it) {
+		states[it->second].fail = 0;
+		states[it->second].output = 0;
+		queue.push_back(it->second);
+	}
+	while (!queue.empty()) {
+		size_t at = queue.front();
+		queue.pop_front();
+		for (std::map<char, size_t>::iterator it = states[at].next.begin(); it != states[at].next.end(); ++it) {
+			size_t fail = states[at].fail;
+			while (fail != 0 && states[fail].next.find(it->first) == states[fail].next.end())
+				fail = states[fail].fail;
+			std::map<char, size_t>::iterator to = states[fail].next.find(it->first);
+			fail = to != states[fail].next.end() ? to->second : 0;
+			states[it->second].fail = fail;
+			states[it->second].output = states[fail].patterns.empty() ? states[fail].output : fail;
+			queue.push_back(it->second);
+		}
+	}
+	stale = false;
+}
+
+bool MaskSet::matches(const std::string &subject) const {
+	if (masks.empty())
+		return false;
+	if (stale)
+		compile();
+	std::string f = casefold(subject);
+	for (size_t i = 0; i < unkeyed.size(); i++) {
+		if (match_pattern(patterns[unkeyed[i]], f))
+			return true;
+	}
+
+	size_t at = 0;
+	for (size_t i = 0; i < f.size(); i++) {
+		std::map<char, size_t>::const_iterator it;
+		while ((it = states[at].next.find(f[i])) == states[at].next.end() && at != 0)
+			at = states[at].fail;
+		if (it != states[at].next.end())
+			at = it->second;
+		size_t out = states[at].patterns.empty() ? states[at].output : at;
+		while (out != 0) {
+			const std::vector<size_t> &candidates = states[out].patterns;
+			for (size_t j = 0; j < candidates.size(); j++) {
+				if (match_pattern(patterns[candidates[j]], f))
+					return true;
+			}
+			out = states[out].output;
+		}
+	}
+	return false;
+}
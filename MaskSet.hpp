@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// A list of nick!user@host style masks (`*` matches any run, `?` any one
+// character, comparison in RFC 1459 case) that answers "does any mask
+// match?" without trying every mask in turn. Used for channel bans and
+// invite exceptions and for the server's K-lines.
+//
+// Every mask is compiled into the literal segments between its stars, and
+// its longest literal run becomes its key: a mask can only match a subject
+// that contains its key. The keys of all masks go into one Aho-Corasick
+// automaton, so a check reads the subject once and only runs the full
+// match for masks whose key it passed over. Masks without any literal
+// ("*", "?*") are tried on every check.
+class MaskSet {
+	private:
+		struct pattern {
+			std::vector<std::string> segments; // Between stars, may hold `?`.
+			bool                     star;       // Contains at least one `*`.
+			bool                     star_start; // Starts with `*`.
+			bool                     star_end;   // Ends with `*`.
+			size_t                   min_size;
+		};
+
+		struct state {
+			std::map<char, size_t> next;
+			size_t                 fail;
+			// Nearest state down the fail links that ends some keys.
+			size_t                 output;
+			std::vector<size_t>    patterns; // Whose key ends here.
+		};
+
+		std::vector<std::string> masks;    // As given, in insertion order.
+		std::vector<std::string> folded;   // Same order, case folded.
+		std::vector<pattern>     patterns; // Same order.
+
+		// Built on the first check after a change.
+		mutable bool                stale;
+		mutable std::vector<state>  states;
+		mutable std::vector<size_t> unkeyed;
+
+		void    compile() const;
+		static pattern make_pattern(const std::string &folded_mask);
+		static std::string key_of(const std::string &folded_mask);
+		static bool match_pattern(const pattern &p, const std::string &subject);
+
+	public:
+		MaskSet();
+		// Return false when the mask was already there / was not there.
+		bool    add(const std::string &mask);
+		bool    remove(const std::string &mask);
+		bool    matches(const std::string &subject) const;
+		const std::vector<std::string> &get_masks() const;
+		size_t  size() const;
+		void    clear();
+
+		// RFC 1459 case folding: A-Z, []\^ become a-z, {}|~.
+		static std::string casefold(const std::string &s);
+		// Single mask check, the reference the set is measured against.
+		static bool match(const std::string &mask, const std::string &subject);
+};
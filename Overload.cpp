@@ -0,0 +1,89 @@
+#include "Overload.hpp"
+#include "Clock.hpp"
+
+// Thresholds of pause_accepts .. shed_clients.
+static const uint64_t lag_thresholds[] = {
+    20 * 1000000ULL, 50 * 1000000ULL, 100 * 1000000ULL, 250 * 1000000ULL};
+static const size_t output_thresholds[] = {
+    4 << 20, 8 << 20, 16 << 20, 32 << 20};
+
+Overload::Overload() : current(normal), lag(0), resume_accepts_at(0), short_of_descriptors(false) {
+	counters.accept_pauses = 0;
+	counters.descriptor_pauses = 0;
+	counters.limited_reads = 0;
+	counters.dropped_notices = 0;
+	counters.shed_clients = 0;
+	counters.peak_lag_nanoseconds = 0;
+	counters.peak_output_bytes = 0;
+}
+
+Overload::stage Overload::update(uint64_t busy_nanoseconds, size_t output_bytes) {
+	// An exponential moving average over about eight iterations, so one
+	// slow iteration does not flip the stage back and forth.
+	lag = lag - lag / 8 + busy_nanoseconds / 8;
+	if (lag > counters.peak_lag_nanoseconds)
+		counters.peak_lag_nanoseconds = lag;
+	if (output_bytes > counters.peak_output_bytes)
+		counters.peak_output_bytes = output_bytes;
+
+	int next = normal;
+	for (int i = 0; i < 4; i++) {
+		if (lag >= lag_thresholds[i] || output_bytes >= output_thresholds[i])
+			next = i + 1;
+	}
+	if (resume_accepts_at != 0) {
+		if (monotonic_nanoseconds() < resume_accepts_at)
+			next = next < pause_accepts ? pause_accepts : next;
+		else
+			resume_accepts_at = 0;
+	}
+	if (current < pause_accepts && next >= pause_accepts)
+		counters.accept_pauses++;
+	current = static_cast<stage>(next);
+	return current;
+}
+
+Overload::stage Overload::get_stage() const {
+	return current;
+}
+
+bool Overload::accepting() const {
+	return current < pause_accepts;
+}
+
+bool Overload::out_of_descriptors() {
+	if (resume_accepts_at == 0)
+		counters.descriptor_pauses++;
+	resume_accepts_at = monotonic_nanoseconds() + DESCRIPTOR_PAUSE_NANOSECONDS;
+	if (current < pause_accepts) {
+		current = pause_accepts;
+		counters.accept_pauses++;
+	}
+	bool first = !short_of_descriptors;
+	short_of_descriptors = true;
+	return first;
+}
+
+void Overload::accepted() {
+	short_of_descriptors = false;
+}
+
+size_t Overload::shed_target() {
+	return output_thresholds[drop_notices - 1];
+}
+
+void Overload::count_limited_read() {
+	counters.limited_reads++;
+}
+
+void Overload::count_dropped_notice() {
+	counters.dropped_notices++;
+}
+
+void Overload::count_shed_client() {
+	counters.shed_clients++;
+}
+
+const Overload::stats &Overload::get_stats() const {
+	return counters;
+}
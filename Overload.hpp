@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Overload protection for the event loop. After every loop iteration the
+// Server reports how long the iteration was busy and how many bytes sit in
+// client output queues; a smoothed lag and the queued bytes each map to a
+// stage, and the higher of the two is the stage the server runs in:
+//
+//	pause_accepts	the listening socket is not watched; new
+//			connections wait in the kernel backlog
+//	limit_reads	each read takes at most LIMITED_READ_SIZE bytes, the
+//			rest stays in the socket and pushes back on the sender;
+//			clients with more than PAUSE_READ_OUTPUT of their own
+//			output queued are not read until it drains
+//	drop_notices	NOTICEs to channels of LARGE_CHANNEL members or more
+//			are dropped
+//	shed_clients	the clients with the most queued output are
+//			disconnected until the queues are back under the
+//			drop_notices threshold; clients with less than
+//			SHED_MIN_OUTPUT queued are left to drain instead
+//
+// Each stage includes the ones before it. When accept() runs out of file
+// descriptors, the server is held in pause_accepts or higher for
+// DESCRIPTOR_PAUSE_NANOSECONDS, so it does not spin on a listening socket it
+// cannot take connections from.
+#define LARGE_CHANNEL 50
+#define LIMITED_READ_SIZE 512
+#define PAUSE_READ_OUTPUT (256 << 10)
+#define SHED_MIN_OUTPUT (1 << 20)
+#define DESCRIPTOR_PAUSE_NANOSECONDS (100 * 1000000ULL)
+
+class Overload {
+	public:
+		enum stage {
+			normal,
+			pause_accepts,
+			limit_reads,
+			drop_notices,
+			shed_clients,
+		};
+
+		struct stats {
+			unsigned long accept_pauses;   // Times accepts got paused.
+			// Of those, the times for running out of descriptors.
+			unsigned long descriptor_pauses;
+			unsigned long limited_reads;
+			unsigned long dropped_notices; // One per channel NOTICE.
+			unsigned long shed_clients;
+			uint64_t      peak_lag_nanoseconds;
+			size_t        peak_output_bytes;
+		};
+
+	private:
+		stage       current;
+		uint64_t    lag;
+		// Monotonic time until which accepts stay paused, 0 for none.
+		uint64_t    resume_accepts_at;
+		// Set from the first EMFILE/ENFILE to the next accepted client.
+		bool        short_of_descriptors;
+		stats       counters;
+
+	public:
+		Overload();
+		// Called once per loop iteration; returns the new stage.
+		stage   update(uint64_t busy_nanoseconds, size_t output_bytes);
+		stage   get_stage() const;
+		bool    accepting() const;
+		// accept() failed with EMFILE or ENFILE. Pauses accepts right
+		// away; returns true for the first failure since a client was
+		// last accepted, so the shortage gets logged once.
+		bool    out_of_descriptors();
+		void    accepted();
+		// Output queues are shed down to this many bytes.
+		static size_t shed_target();
+
+		void    count_limited_read();
+		void    count_dropped_notice();
+		void    count_shed_client();
+		const stats &get_stats() const;
+};
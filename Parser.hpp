@@ -7,6 +7,16 @@
 #include <string>
 #include <vector>
 
+// Lexemes, messages and parsemes own their strings. Under C++11 and later
+// they are moved from the lexer to the parser to the caller. Under C++98 words
+// are still handed over with swap, only the result vectors copy.
+#if __cplusplus >= 201103L
+#include <utility>
+#define IRC_MOVE(x) std::move(x)
+#else
+#define IRC_MOVE(x) (x)
+#endif
+
 // Lexer.
 
 namespace lex_error {
@@ -17,15 +27,15 @@ enum type {
 }
 
 struct lexeme {
-	enum {
+	enum lexeme_tag {
 		carriage_return_line_feed,
 		word,
 
 		error,
 		nothing,
 	} tag;
-	union {
-		char *word;
+	struct {
+		std::string word;
 		lex_error::type error;
 	} value;
 };
@@ -38,18 +48,70 @@ struct lex_state {
 	} state;
 	std::string word;
 	bool in_trailing;
+	// No word of the line taken yet.
+	bool line_start;
+	// The first word was @tags, so a ':' after it starts the prefix
+	// rather than the trailing parameter.
+	bool after_tags;
+};
+
+// Owns the tag text of a message or of the line under way. Few lines have
+// tags, so the string is only allocated for a line that starts with '@' and
+// an untagged message carries a null pointer.
+class tag_text {
+public:
+	tag_text() : text(0) {}
+	tag_text(const tag_text &other)
+	    : text(other.text ? new std::string(*other.text) : 0) {}
+#if __cplusplus >= 201103L
+	tag_text(tag_text &&other) noexcept : text(other.text) { other.text = 0; }
+#endif
+	~tag_text() { delete text; }
+	tag_text &operator=(tag_text other) {
+		swap(other);
+		return *this;
+	}
+	void swap(tag_text &other) {
+		std::string *t = text;
+		text = other.text;
+		other.text = t;
+	}
+	// Takes the text of `s`, leaving it empty.
+	void take(std::string &s) {
+		if (!text)
+			text = new std::string;
+		text->swap(s);
+		s.clear();
+	}
+	void clear() {
+		delete text;
+		text = 0;
+	}
+	// True from take() to clear(), even when the tags are empty.
+	bool has_value() const { return text != 0; }
+	bool empty() const { return !text || text->empty(); }
+	const std::string &str() const {
+		static const std::string none;
+		return text ? *text : none;
+	}
+	operator const std::string &() const { return str(); }
+
+private:
+	std::string *text;
 };
 
 struct message {
-	char *prefix; // Nilable. Unused.
-	char *command;
-	char **params;
-	int params_count;
+	// IRCv3 tags as they came, without the '@'; see get_tag().
+	tag_text tags;
+	std::string prefix; // Empty when there is none.
+	std::string command;
+	std::vector<std::string> params;
 };
 
 namespace parse_error {
 enum type {
 	no_command,
+	bad_line,
 };
 }
 
@@ -59,7 +121,7 @@ struct parseme {
 		message,
 		error,
 	} tag;
-	union {
+	struct {
 		::message message;
 		parse_error::type error;
 	} value;
@@ -71,13 +133,38 @@ template <class t> struct optional {
 };
 
 struct parse_state {
+	tag_text tags;
 	optional<std::string> prefix;
+	std::string command;
 	std::vector<std::string> words;
 };
 
+lex_state make_lex_state();
+parse_state make_parse_state();
+
 lexeme lex(char c, lex_state *l);
 std::vector<lexeme> lex_string(const char *string, lex_state *state);
-void print_message(message m);
-parseme parse(lexeme l, parse_state *p);
-std::vector<parseme> parse_lexeme_string(std::vector<lexeme> lexemes,
-					 parse_state *state);
\ No newline at end of file
+void print_message(const message &m);
+// Takes the word out of `l`.
+parseme parse(lexeme &l, parse_state *p);
+// Consumes `lexemes`: their words are moved into the returned messages.
+std::vector<parseme> parse_lexeme_string(std::vector<lexeme> &lexemes,
+					 parse_state *state);
+// Lexes and parses `size` bytes of a stream, appending each completed message
+// to `messages`. A bare LF ends a line like CRLF does, for netcat users.
+void parse_buffer(const char *data, size_t size, lex_state *l, parse_state *p,
+		  std::vector<message> &messages);
+
+// Tags.
+//
+// An `@key=value;key2` word before the prefix is kept whole in message::tags.
+// Nothing looks inside it until a handler asks, so untagged lines, and
+// tagged ones nobody asks about, cost one check of the first character.
+
+// Finds key in tags and unescapes its value into `value` (\: ; \s space
+// \\ backslash \r \n, any other \x is x, a lone trailing \ is dropped). A key
+// without a value has an empty one.
+bool get_tag(const std::string &tags, const std::string &key, std::string &value);
+// The client-only tags (keys starting with '+') of tags, still escaped, for
+// passing on to other clients.
+std::string client_tags(const std::string &tags);
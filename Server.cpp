@@ -1,15 +1,120 @@
 #include "Server.hpp"
 #include "Client.hpp"
+#include "Clock.hpp"
+#include "Compressor.hpp"
+#include "IRCResponse.hpp"
+#include "Text.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <algorithm>
+#include <fstream>
+
+volatile sig_atomic_t Server::signaled = 0;
+
+void Server::handle_signal(int signal) {
+    (void)signal;
+    signaled = 1;
+}
+
 Server::Server(const std::string &port, const std::string &pass)
-    : port(port), host("127.0.0.1"), pass(pass)
+    : port(port), host("127.0.0.1"), pass(pass), client_memory_limit(CLIENT_MEMORY_LIMIT),
+      memory_budget(MEMORY_BUDGET), capture(NULL), channel_log(NULL), uring(NULL),
+      prefer_uring(true),
+      measure_commands(false), output_bytes(0), history(HISTORY_ARENA_SIZE), tls_sock(-1),
+      tls_context(NULL)
 {
     running = 1;
-    sock = initialize_socket();
-    //todo parse_init 
+    sock = initialize_socket(port);
+    pollfd srv = {sock, POLLIN, 0};
+    fds.push_back(srv);
+
+    commands["PASS"] = &Server::cmd_pass;
+    commands["NICK"] = &Server::cmd_nick;
+    commands["USER"] = &Server::cmd_user;
+    commands["PING"] = &Server::cmd_ping;
+    commands["PONG"] = &Server::cmd_pong;
+    commands["QUIT"] = &Server::cmd_quit;
+    commands["JOIN"] = &Server::cmd_join;
+    commands["PART"] = &Server::cmd_part;
+    commands["PRIVMSG"] = &Server::cmd_privmsg;
+    commands["NOTICE"] = &Server::cmd_notice;
+    commands["MODE"] = &Server::cmd_mode;
+    commands["CHATHISTORY"] = &Server::cmd_chathistory;
+    commands["SERVER"] = &Server::cmd_server;
+    commands["CONNECT"] = &Server::cmd_connect;
+    commands["COMPRESS"] = &Server::cmd_compress;
+    commands["CAP"] = &Server::cmd_cap;
+    commands["TAGMSG"] = &Server::cmd_tagmsg;
+    commands["OPER"] = &Server::cmd_oper;
+    commands["MEMORY"] = &Server::cmd_memory;
+    commands["LIST"] = &Server::cmd_list;
+    commands["NAMES"] = &Server::cmd_names;
+    commands["WHO"] = &Server::cmd_who;
+
+    link_commands["PING"] = &Server::link_ping;
+    link_commands["PONG"] = &Server::cmd_pong;
+    link_commands["ERROR"] = &Server::link_error;
+    link_commands["SERVER"] = &Server::link_server;
+    link_commands["SQUIT"] = &Server::link_squit;
+    link_commands["NICK"] = &Server::link_nick;
+    link_commands["QUIT"] = &Server::link_quit;
+    link_commands["KILL"] = &Server::link_kill;
+    link_commands["JOIN"] = &Server::link_join;
+    link_commands["NJOIN"] = &Server::link_njoin;
+    link_commands["PART"] = &Server::link_part;
+    link_commands["PRIVMSG"] = &Server::link_text;
+    link_commands["NOTICE"] = &Server::link_text;
+    link_commands["MODE"] = &Server::link_mode;
+    link_counters.bursts = 0;
+    link_counters.burst_lines = 0;
+    link_counters.burst_bytes = 0;
+    link_counters.netsplits = 0;
+    link_counters.split_users = 0;
+    link_counters.relayed = 0;
+    link_counters.relay_bytes_saved = 0;
+    link_counters.link_lines = 0;
+    link_counters.link_writes = 0;
+    compression.clients = 0;
+    compression.batches = 0;
+    compression.bytes_in = 0;
+    compression.bytes_out = 0;
+    compression.nanoseconds = 0;
+    tls_counters.handshakes = 0;
+    tls_counters.failed_handshakes = 0;
+    tls_counters.kernel_send = 0;
+    tls_counters.kernel_recv = 0;
+    closing_counters.clients = 0;
+    closing_counters.batches = 0;
+    closing_counters.largest_batch = 0;
+    memory_counters.used = 0;
+    memory_counters.peak = 0;
+    memory_counters.limit_closes = 0;
+    memory_counters.budget_closes = 0;
+    task_counters.started = 0;
+    task_counters.deferred = 0;
+    task_counters.steps = 0;
+    task_counters.budget_stops = 0;
+    task_counters.most_steps = 0;
+    task_counters.waited = 0;
+    task_counters.refused = 0;
+    task_counters.nanoseconds = 0;
+    reply_cache_counters.list_hits = 0;
+    reply_cache_counters.list_misses = 0;
+    reply_cache_counters.who_hits = 0;
+    reply_cache_counters.who_misses = 0;
 }
 
-int Server::initialize_socket() {
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+// Listens on IPv6 and IPv4 at once where the host has IPv6, and on IPv4
+// only otherwise.
+int Server::initialize_socket(const std::string &port) {
+    bool dual_stack = true;
+    int sock_fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (sock_fd < 0 && (errno == EAFNOSUPPORT || errno == EPROTONOSUPPORT)) {
+        dual_stack = false;
+        sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    }
     if (sock_fd < 0) {
         throw std::runtime_error("Eror: Unabl to opn the socket sqses 🤮 բուլկի");
     }
@@ -18,6 +123,10 @@ int Server::initialize_socket() {
     if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval))) {
         throw std::runtime_error("Error: Unable to set socket options.");
     }
+    int v6_only = 0;
+    if (dual_stack && setsockopt(sock_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(v6_only))) {
+        throw std::runtime_error("Error: Unable to accept IPv4 on the IPv6 socket.");
+    }
 
     if (fcntl(sock_fd, F_SETFL, O_NONBLOCK)) {
         throw std::runtime_error("Error: Unable to set socket as non-blocking.");
@@ -27,8 +136,15 @@ int Server::initialize_socket() {
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
     serv_addr.sin_port = htons(atoi(port.c_str()));
+    struct sockaddr_in6 serv_addr6 = {};
+    serv_addr6.sin6_family = AF_INET6;
+    serv_addr6.sin6_addr = in6addr_any;
+    serv_addr6.sin6_port = serv_addr.sin_port;
 
-    if (bind(sock_fd, reinterpret_cast<sockaddr*>(&serv_addr), sizeof(serv_addr)) < 0) {
+    int bound = dual_stack
+        ? bind(sock_fd, reinterpret_cast<sockaddr*>(&serv_addr6), sizeof(serv_addr6))
+        : bind(sock_fd, reinterpret_cast<sockaddr*>(&serv_addr), sizeof(serv_addr));
+    if (bound < 0) {
         throw std::runtime_error("Error: Failed to bind the socket.");
     }
 
@@ -42,58 +158,342 @@ int Server::initialize_socket() {
 
 Server::~Server()
 {
-    // for (size_t i = 0; i < _channels.size(); i++)
-    //     delete _clients[i];
+    while (!clients.empty())
+        disconnect_client(clients.begin()->first);
+    for (std::map<std::string, Channel *>::iterator it = channels.begin(); it != channels.end(); ++it)
+        delete it->second;
+    close(sock);
+    if (tls_sock >= 0)
+        close(tls_sock);
+    delete tls_context;
+    delete capture;
+    delete channel_log;
+}
+
+void Server::enable_capture(const std::string &path) {
+    delete capture;
+    capture = NULL;
+    capture = new Capture(path);
+}
+
+void Server::enable_log(const std::string &directory) {
+    delete channel_log;
+    channel_log = NULL;
+    channel_log = new ChannelLog(directory);
+}
+
+void Server::load_klines(const std::string &path) {
+    std::ifstream file(path.c_str());
+    if (!file)
+        throw std::runtime_error("Error: Unable to open the K-line file " + path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (!line.empty() && line[0] != '#')
+            klines.add(line);
+    }
+}
+
+static void load_prefixes(const std::string &path, const std::string &what, CidrTrie &trie) {
+    std::ifstream file(path.c_str());
+    if (!file)
+        throw std::runtime_error("Error: Unable to open the " + what + " file " + path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (line.empty() || line[0] == '#')
+            continue;
+        ip_address address;
+        unsigned length;
+        if (!CidrTrie::parse(line, address, length))
+            throw std::runtime_error("Error: Bad " + what + " " + line);
+        trie.at(address, length) = 1;
+    }
+}
+
+void Server::load_dlines(const std::string &path) {
+    load_prefixes(path, "D-line", dlines);
+}
+
+void Server::load_exemptions(const std::string &path) {
+    load_prefixes(path, "exemption", exemptions);
+}
+
+void Server::use_poll() {
+    prefer_uring = false;
+}
+
+void Server::enable_command_stats() {
+    measure_commands = true;
+}
+
+const std::map<std::string, command_stat> &Server::get_command_stats() const {
+    return command_stats;
+}
+
+const Overload::stats &Server::get_overload_stats() const {
+    return overload.get_stats();
+}
+
+const History::stats &Server::get_history_stats() const {
+    return history.get_stats();
+}
+
+const compression_stats &Server::get_compression_stats() const {
+    return compression;
+}
+
+const tls_stats &Server::get_tls_stats() const {
+    return tls_counters;
+}
+
+const closing_stats &Server::get_closing_stats() const {
+    return closing_counters;
+}
+
+const task_stats &Server::get_task_stats() const {
+    return task_counters;
+}
+
+const reply_cache_stats &Server::get_reply_cache_stats() const {
+    return reply_cache_counters;
+}
+
+void Server::set_memory_limits(size_t client_limit, size_t budget) {
+    client_memory_limit = client_limit;
+    memory_budget = budget;
+}
+
+const memory_stats &Server::get_memory_stats() const {
+    return memory_counters;
+}
+
+void Server::set_oper(const std::string &name, const std::string &password) {
+    oper_name = name;
+    oper_password = password;
 }
 
-void Server::connect_client() {
-    sockaddr_in addr = {};
+void Server::enable_tls(const std::string &port, const std::string &certificate, const std::string &key) {
+    tls_context = certificate.empty() ? TlsContext::self_signed(host)
+                                      : new TlsContext(certificate, key);
+    tls_sock = initialize_socket(port);
+    pollfd listener = {tls_sock, POLLIN, 0};
+    fds.push_back(listener);
+}
+
+const ChannelLog::stats *Server::get_log_stats() const {
+    return channel_log ? &channel_log->get_stats() : NULL;
+}
+
+size_t Server::client_count() const {
+    return clients.size();
+}
+
+size_t Server::queued_output() const {
+    return output_bytes;
+}
+
+void Server::connect_client(int listener) {
+    sockaddr_storage addr = {};
     socklen_t size = sizeof(addr);
 
-    int fd = accept(sock, reinterpret_cast<sockaddr*>(&addr), &size);
+    int fd = accept(listener, reinterpret_cast<sockaddr*>(&addr), &size);
     if (fd < 0) {
-        throw std::runtime_error("Error while accepting a new client!");
+        // EAGAIN and ECONNABORTED (the client reset first) leave nothing
+        // to accept; neither is a reason to stop serving the others.
+        if ((errno == EMFILE || errno == ENFILE) && overload.out_of_descriptors())
+            std::cout << "Out of file descriptors, pausing accepts." << std::endl;
+        return;
     }
+    overload.accepted();
 
-    pollfd pfd = { fd, POLLIN, 0 };
-    fds.push_back(pfd);
+    Client *client = accept_client(fd, reinterpret_cast<sockaddr*>(&addr), size);
+    if (client && listener == tls_sock) {
+        client->tls = new TlsSession(tls_context->wrap(fd));
+        charge(client, Client::memory_fixed, TLS_SESSION_BYTES);
+    }
+}
 
+// D-lines and the per-address and per-subnet caps, checked before a
+// refused connection costs a Client or a DNS lookup.
+bool Server::admit(int fd, const sockaddr *addr) {
+    ip_address address;
+    if (!CidrTrie::from_sockaddr(addr, address))
+        return true;
+    const char *refusal = NULL;
+    unsigned subnet = address.is_v4() ? 96 + 24 : 64;
+    long *per_address = connection_counts.find(address, 128);
+    long *per_subnet = connection_counts.find(address, subnet);
+    bool exempt = exemptions.longest_match(address) != NULL;
+    if (dlines.longest_match(address))
+        refusal = "ERROR :Closing link: You are banned from this server\r\n";
+    else if (!exempt && per_address && *per_address >= MAX_CLIENTS_PER_ADDRESS)
+        refusal = "ERROR :Closing link: Too many connections from your address\r\n";
+    else if (!exempt && per_subnet && *per_subnet >= MAX_CLIENTS_PER_SUBNET)
+        refusal = "ERROR :Closing link: Too many connections from your network\r\n";
+    if (refusal) {
+        send(fd, refusal, strlen(refusal), MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(fd);
+        return false;
+    }
+    connection_counts.at(address, 128)++;
+    connection_counts.at(address, subnet)++;
+    client_addresses[fd] = address;
+    return true;
+}
+
+void Server::release_address(int fd) {
+    std::map<int, ip_address>::iterator it = client_addresses.find(fd);
+    if (it == client_addresses.end())
+        return;
+    const ip_address &address = it->second;
+    unsigned lengths[2] = {128, address.is_v4() ? 96 + 24 : 64u};
+    for (int i = 0; i < 2; ++i) {
+        if (--connection_counts.at(address, lengths[i]) == 0)
+            connection_counts.erase(address, lengths[i]);
+    }
+    client_addresses.erase(it);
+}
+
+Client *Server::accept_client(int fd, const sockaddr *addr, socklen_t size) {
+    if (!admit(fd, addr))
+        return NULL;
+    // IPv4 clients of the dual-stack socket arrive as ::ffff:a.b.c.d.
+    sockaddr_in v4 = {};
+    const sockaddr_in6 *v6 = reinterpret_cast<const sockaddr_in6*>(addr);
+    if (addr->sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr)) {
+        v4.sin_family = AF_INET;
+        v4.sin_port = v6->sin6_port;
+        memcpy(&v4.sin_addr, v6->sin6_addr.s6_addr + 12, 4);
+        addr = reinterpret_cast<const sockaddr*>(&v4);
+        size = sizeof(v4);
+    }
+    // Numeric only: a reverse lookup would block the event loop on DNS.
     char hostname[NI_MAXHOST];
-    if (getnameinfo(reinterpret_cast<sockaddr*>(&addr), sizeof(addr),
-                    hostname, NI_MAXHOST, NULL, 0, NI_NUMERICSERV) != 0) {
-        throw std::runtime_error("Error while getting a hostname on a new client!");
+    if (getnameinfo(addr, size, hostname, NI_MAXHOST, NULL, 0, NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        release_address(fd);
+        close(fd);
+        return NULL;
+    }
+
+    int port = 0;
+    if (addr->sa_family == AF_INET)
+        port = ntohs(reinterpret_cast<const sockaddr_in*>(addr)->sin_port);
+    else if (addr->sa_family == AF_INET6)
+        port = ntohs(reinterpret_cast<const sockaddr_in6*>(addr)->sin6_port);
+    try {
+        return add_client(fd, port, std::string(hostname));
+    } catch (const std::exception &e) {
+        // add_client has closed the socket; one bad client is no reason
+        // to stop serving the rest.
+        std::cout << e.what() << std::endl;
+        release_address(fd);
+        return NULL;
+    }
+}
+
+Client *Server::add_client(int fd, int port, const std::string &hostname) {
+    if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
+        close(fd);
+        throw std::runtime_error("Error: Unable to set client socket as non-blocking.");
     }
 
-    Client* client = new Client(fd, ntohs(addr.sin_port), std::string(hostname));
+    pollfd pfd = { fd, POLLIN, 0 };
+    fds.push_back(pfd);
+
+    Client* client = new Client(fd, port, hostname);
     clients.insert(std::make_pair(fd, client));
+    charge(client, Client::memory_fixed, sizeof(Client));
+    if (capture)
+        capture->connected(fd, hostname);
 
     char message[1000];
     sprintf(message, "%s:%d has connected.\n", client->get_hostname().c_str(), client->get_port());
     std::cout << message;
+    return client;
 }
 
 
 void	Server::disconnect_client(int fd)
+{
+    release_client(fd);
+    for (std::vector<pollfd>::iterator it = fds.begin(); it != fds.end(); ++it) {
+        if (it->fd == fd) {
+            fds.erase(it);
+            break;
+        }
+    }
+}
+
+void	Server::close_client(Client *client)
+{
+    if (client->closing)
+        return;
+    client->closing = true;
+    closing.push_back(client->get_fd());
+}
+
+// Closing a client erases its entry from fds, which the poll loop is
+// walking, and may close others (a link takes its users along), so the
+// loops only mark clients and the teardown happens here, after the pass:
+// one sweep over fds for however many went.
+void	Server::reap_clients()
+{
+    std::vector<int> closed;
+    while (!closing.empty()) {
+        std::vector<int> batch;
+        batch.swap(closing);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            release_client(batch[i]);
+            closed.push_back(batch[i]);
+        }
+    }
+    if (closed.empty())
+        return;
+    std::sort(closed.begin(), closed.end());
+    size_t kept = 0;
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (!std::binary_search(closed.begin(), closed.end(), fds[i].fd))
+            fds[kept++] = fds[i];
+    }
+    fds.resize(kept);
+    closing_counters.clients += closed.size();
+    closing_counters.batches++;
+    closing_counters.largest_batch = std::max<unsigned long>(closing_counters.largest_batch, closed.size());
+}
+
+void	Server::release_client(int fd)
 {
     try {
 
     Client* client = clients.at(fd);
 
-    //leave client
-    /*TODO leave function*/
-    //client->leave() leave from channel
-        clients.erase(fd);
-        std::vector<pollfd>::iterator it_b = fds.begin();
-        std::vector<pollfd>::iterator it_e = fds.end();
-        while (it_b != it_e) {
-            if (it_b->fd == fd) {
-                it_b = fds.erase(it_b);
-                close(fd);
-                break;
-            } else {
-                ++it_b;
-            }
+        if (client->is_registered()) {
+            std::string reason = client->is_quitting() ? client->get_quit_reason() : "Connection closed";
+            std::string quit = IRCResponse::RPL_QUIT(client->get_source(), reason);
+            notify_peers(client, quit);
+            propagate(quit, NULL);
         }
+        if (client->kind == Client::link)
+            netsplit(client);
+        while (!client->channels.empty())
+            part_channel(client, channels[*client->channels.begin()]);
+        std::map<std::string, Client *>::iterator nick = nicknames.find(fold_name(client->get_nickname()));
+        if (nick != nicknames.end() && nick->second == client)
+            nicknames.erase(nick);
+
+        drop_task(client);
+        clients.erase(fd);
+        release_address(fd);
+        output_bytes -= client->output.size() + client->compressed.size();
+        memory_counters.used -= client->memory_total;
+        if (capture)
+            capture->disconnected(fd);
+        if (uring)
+            uring->forget(fd);
+        close(fd);
 
         char message[1000];
         sprintf(message, "%s:%d has disconnected!\n", client->get_hostname().c_str(), client->get_port());
@@ -105,109 +505,503 @@ void	Server::disconnect_client(int fd)
     }
 }
 
-struct message Server::get_client_message(int fd) {
-    struct message m;
-    std::string message;
-    char buffer[1024];
+std::vector<message> Server::get_client_message(Client *client) {
+    std::vector<message> messages;
     int bytesRead;
 
-    bytesRead = recv(fd, buffer, sizeof(buffer), 0);
+    size_t budget = sizeof(read_buffer);
+    if (overload.get_stage() >= Overload::limit_reads) {
+        budget = LIMITED_READ_SIZE;
+        overload.count_limited_read();
+    }
+    bytesRead = read_socket(client, read_buffer, budget);
 
-    if (bytesRead < 0 && errno != EWOULDBLOCK) {
+    if (bytesRead < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
         std::cout << "Error occurred during recv: " << strerror(errno) << std::endl;
         throw std::runtime_error("Error while reading buffer from a client!");
     }
-    message.append(buffer);
-        
-    std::cout << "message is " << message << std::endl;
-    std::cout << "bull" << (message.back() == '\n') << std::endl;
-    size_t lastNewlinePos = message.find_last_of('\n');
-    if (lastNewlinePos != std::string::npos) {
-        message.replace(lastNewlinePos, 1, "\r\n");
-    }
-    std::cout << "Modified message is " << message << std::endl;
-    std::string simulated_message = ":Nickname!username@hostname.com PRIVMSG #channel :Hello everyone! How are you today?\r\n";
-    lex_state lexerState = {
-        .state = lex_state::in_word,
-        .word = "",
-        .in_trailing = false,
-    };
-    std::vector<lexeme> lexemes = lex_string(message.c_str(), &lexerState);
-    if (lexemes.empty()) {
-        std::cout << "lexemes are empty\n";
-    }
-    parse_state parserState = {
-        .prefix =
-        {
-            .has_value = false,
-        },
-    };
-    std::vector<parseme> parsedMessages = parse_lexeme_string(lexemes, &parserState);
-    if (!parsedMessages.empty()) {
-        std::cout << "}}}}\n";
-        for (size_t i = 0; i < parsedMessages.size(); ++i) {
-            std::cout <<  "here\n";
-            std::cout << "i is " << i << std::endl;
-            if (parsedMessages[i].tag == parseme::message) {
-                m = parsedMessages[i].value.message;
-                std::cout << ">>>>>>>>>>" << m.prefix << "<<<<<<<<<<<<" << std::endl;
-            }
-        }
-    } else {
-        std::cout << "parsedMessages is empty!" << std::endl;
+    if (bytesRead == 0) {
+        throw std::runtime_error("Connection closed by the client.");
+    }
+    if (bytesRead < 0) {
+        return messages;
     }
-    return m;
+    if (capture)
+        capture->received(client->get_fd(), read_buffer, bytesRead);
+
+    parse_buffer(read_buffer, bytesRead, &client->lexer, &client->parser, messages);
+    charge_input(client);
+    return messages;
+}
+
+bool    Server::receive(Client *client, const char *data, size_t size)
+{
+    if (client->closing)
+        return false;
+    if (capture)
+        capture->received(client->get_fd(), data, size);
+    std::vector<message> messages;
+    parse_buffer(data, size, &client->lexer, &client->parser, messages);
+    charge_input(client);
+    return dispatch_all(client, messages);
 }
 
-void    Server::handle_client_message(int fd)
+bool    Server::dispatch_all(Client *client, std::vector<message> &messages)
 {
+    for (size_t i = 0; i < messages.size() && !client->is_quitting(); ++i)
+        dispatch(client, messages[i]);
+    if (client->is_quitting()) {
+        flush_client(client);
+        close_client(client);
+        return false;
+    }
+    return true;
+}
+
+bool    Server::handle_client_message(int fd)
+{
+    bool connected;
     try
     {
-        Client*     client = clients.at(fd); (void)client;
-        message message = this->get_client_message(fd);
-        std::cout << "prefix ->> " << message.prefix << std::endl;
-        std::cout << "command ->> " << message.command << std::endl;
-        // if(message && message.params) {
-        //     std::cout << "params ->> " << message.params[0] << std::endl;
-        //     std::cout << "params ->> " << message.params[1] << std::endl;
-        // }
-
+        Client*     client = clients.at(fd);
+        std::vector<message> messages = this->get_client_message(client);
+        connected = dispatch_all(client, messages);
     }
     catch (const std::exception& e)
     {
         std::cout << "Error while handling the client message! " << e.what() << std::endl;
+        std::map<int, Client *>::iterator it = clients.find(fd);
+        if (it != clients.end())
+            close_client(it->second);
+        connected = false;
     }
+    return connected;
 }
 
-void Server::start() {
-    pollfd srv = {sock, POLLIN, 0};
-    fds.push_back(srv);
+void Server::dispatch(Client *client, message &m) {
+    for (size_t i = 0; i < m.command.size(); ++i)
+        m.command[i] = toupper((unsigned char)m.command[i]);
+    if (client->kind == Client::link) {
+        dispatch_link(client, m);
+        return;
+    }
+
+    std::map<std::string, command_handler>::iterator it = commands.find(m.command);
+    if (it == commands.end()) {
+        if (client->is_registered())
+            reply(client, IRCResponse::ERR_UNKNOWNCOMMAND(client->get_nickname(), m.command));
+        return;
+    }
+    if (!client->is_registered() && m.command != "PASS" && m.command != "NICK"
+        && m.command != "USER" && m.command != "QUIT" && m.command != "PING"
+        && m.command != "PONG" && m.command != "SERVER" && m.command != "CAP") {
+        reply(client, IRCResponse::ERR_NOTREGISTERED("*"));
+        return;
+    }
+    // Parameters must be UTF-8; a line that is not is dropped.
+    for (size_t i = 0; i < m.params.size(); ++i) {
+        if (!valid_utf8(m.params[i])) {
+            reply(client, IRCResponse::FAIL(m.command, "INVALID_UTF8", "*",
+                                             "Message rejected, text must be UTF-8"));
+            return;
+        }
+    }
+
+    if (!measure_commands) {
+        (this->*it->second)(client, m);
+        return;
+    }
+    uint64_t start = monotonic_nanoseconds();
+    (this->*it->second)(client, m);
+    uint64_t elapsed = monotonic_nanoseconds() - start;
+    command_stat &stat = command_stats[m.command];
+    stat.count++;
+    stat.total_nanoseconds += elapsed;
+    if (elapsed > stat.max_nanoseconds)
+        stat.max_nanoseconds = elapsed;
+}
+
+// Remote users get their lines through their link; see relay().
+void Server::send_to(Client *client, const std::string &line) {
+    if (client->kind == Client::remote_user)
+        return;
+    if (client->kind == Client::link)
+        link_counters.link_lines++;
+    if (client->output.empty())
+        output_ready.push_back(client->get_fd());
+    client->output += line;
+    client->output += "\r\n";
+    output_bytes += line.size() + 2;
+    charge(client, Client::memory_output, line.size() + 2);
+}
+
+void Server::reply(Client *client, const std::string &numeric) {
+    send_to(client, ":" + host + " " + numeric);
+}
+
+// Copies the stored lines as they are, without formatting them again.
+void Server::replay_history(Client *client, const std::string &channel, size_t limit) {
+    size_t before = client->output.size();
+    if (history.replay(channel, limit, client->output) != 0)
+        count_output(client, before);
+}
+
+void Server::count_output(Client *client, size_t before) {
+    size_t added = client->output.size() - before;
+    if (added == 0)
+        return;
+    if (before == 0)
+        output_ready.push_back(client->get_fd());
+    output_bytes += added;
+    charge(client, Client::memory_output, added);
+}
+
+tagged_line::tagged_line(const std::string &line, const std::string &client_tags, bool tags_only)
+    : line(line), client_tags(client_tags), tags_only(tags_only)
+{
+}
+
+const std::string &tagged_line::get_line() const {
+    return line;
+}
+
+bool tagged_line::is_tags_only() const {
+    return tags_only;
+}
+
+const std::string &tagged_line::for_client(const Client *client) {
+    unsigned wanted = client->capabilities & (Client::message_tags | Client::server_time);
+    if (tags_only && !(wanted & Client::message_tags))
+        return variants[0];
+    if (client_tags.empty())
+        wanted &= ~Client::message_tags;
+    if (!wanted)
+        return line;
+    std::string &variant = variants[wanted];
+    if (!variant.empty())
+        return variant;
+    if (wanted & Client::server_time && time.empty()) {
+        uint64_t now = realtime_nanoseconds();
+        time_t seconds = now / 1000000000u;
+        struct tm t;
+        gmtime_r(&seconds, &t);
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "time=%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+                 t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec,
+                 (int)(now / 1000000u % 1000));
+        time = buffer;
+    }
+    variant = "@";
+    if (wanted & Client::server_time)
+        variant += time;
+    if (wanted & Client::message_tags)
+        variant += (wanted & Client::server_time ? ";" : "") + client_tags;
+    variant += " " + line;
+    return variant;
+}
+
+void Server::broadcast(Channel *channel, const std::string &line, Client *except) {
+    tagged_line tagged(line, std::string(), false);
+    broadcast(channel, tagged, except);
+}
+
+void Server::broadcast(Channel *channel, tagged_line &line, Client *except) {
+    const std::vector<Client *> &members = channel->get_clients();
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (members[i] == except)
+            continue;
+        const std::string &out = line.for_client(members[i]);
+        if (!out.empty())
+            send_to(members[i], out);
+    }
+    if (channel_log && !line.is_tags_only())
+        channel_log->append(channel->get_folded_name(), line.get_line());
+}
+
+// Sends as much of the client's output as the socket takes. Returns false
+// when the connection is broken.
+bool Server::flush_client(Client *client) {
+    compress_output(client);
+    std::string &queue = client->compressor ? client->compressed : client->output;
+    if (client->tls && !client->tls->is_established())
+        return true;
+    while (!queue.empty()) {
+        ssize_t sent = write_socket(client, queue.data(), queue.size());
+        if (client->kind == Client::link)
+            link_counters.link_writes++;
+        if (sent < 0) {
+            return errno == EWOULDBLOCK || errno == EAGAIN;
+        }
+        queue.erase(0, sent);
+        output_bytes -= sent;
+        charge(client, Client::memory_output, -sent);
+    }
+    return true;
+}
+
+// For a TLS client whose direction the kernel did not take, OpenSSL's
+// result is turned into what recv() or send() would have returned, so the
+// callers handle both the same way.
+ssize_t Server::read_socket(Client *client, char *buffer, size_t size) {
+    if (!client->tls || client->tls->receives_in_kernel())
+        return recv(client->get_fd(), buffer, size, 0);
+    size_t done = 0;
+    switch (client->tls->read(buffer, size, done)) {
+    case TlsSession::ok:
+        return done;
+    case TlsSession::closed:
+        return 0;
+    case TlsSession::failed:
+        errno = EPROTO;
+        return -1;
+    default:
+        errno = EAGAIN;
+        return -1;
+    }
+}
+
+ssize_t Server::write_socket(Client *client, const char *data, size_t size) {
+    if (!client->tls || client->tls->sends_in_kernel())
+        return send(client->get_fd(), data, size, 0);
+    size_t done = 0;
+    switch (client->tls->write(data, size, done)) {
+    case TlsSession::ok:
+        return done;
+    case TlsSession::want_read:
+    case TlsSession::want_write:
+        errno = EAGAIN;
+        return -1;
+    default:
+        errno = EPIPE;
+        return -1;
+    }
+}
+
+// Returns false when the handshake failed and the client has to go.
+bool Server::tls_handshake(Client *client) {
+    switch (client->tls->handshake()) {
+    case TlsSession::want_read:
+    case TlsSession::want_write:
+        return true;
+    case TlsSession::ok:
+        break;
+    default:
+        tls_counters.failed_handshakes++;
+        return false;
+    }
+    tls_counters.handshakes++;
+    tls_counters.kernel_send += client->tls->sends_in_kernel();
+    tls_counters.kernel_recv += client->tls->receives_in_kernel();
+    return true;
+}
 
+// The whole batch queued since the last flush goes through deflate at once,
+// which costs far less per byte than compressing line by line.
+void Server::compress_output(Client *client) {
+    if (!client->compressor || client->output.empty())
+        return;
+    uint64_t start = monotonic_nanoseconds();
+    size_t before = client->compressed.size();
+    client->compressor->compress(client->output.data(), client->output.size(), client->compressed);
+    size_t produced = client->compressed.size() - before;
+    compression.batches++;
+    compression.bytes_in += client->output.size();
+    compression.bytes_out += produced;
+    compression.nanoseconds += monotonic_nanoseconds() - start;
+    output_bytes -= client->output.size();
+    output_bytes += produced;
+    charge(client, Client::memory_output, (ptrdiff_t)produced - (ptrdiff_t)client->output.size());
+    client->output.clear();
+}
+
+void Server::start() {
     std::cout << "Server is running...\n";
-    std::vector<pollfd>::iterator it;
 
-    while (running) {
-        if (poll(&fds[0], fds.size(), -1) < 0) {
-            throw std::runtime_error("Error while polling from fd!");
+    // The TLS handshake and user-space records work on readiness, not
+    // completions, so with a TLS port the poll loop runs.
+    if (prefer_uring && !tls_context)
+        uring = UringLoop::create(*this, sock);
+    for (std::map<std::string, link_config>::iterator it = link_configs.begin(); it != link_configs.end(); ++it) {
+        if (!it->second.autoconnect)
+            continue;
+        try {
+            connect_link(it->second);
+        } catch (const std::exception &e) {
+            std::cout << e.what() << std::endl;
         }
+    }
+    if (uring) {
+        uring->run();
+        delete uring;
+        uring = NULL;
+        return;
+    }
+    while (running && !signaled) {
+        poll_once(-1);
+    }
+}
 
-        for (it = fds.begin(); it != fds.end(); ++it) {
-            if (it->revents == 0) {
-                continue;
-            }
+void Server::end_iteration(uint64_t busy_nanoseconds) {
+    busy_nanoseconds += run_tasks();
+    if (overload.update(busy_nanoseconds, output_bytes) == Overload::shed_clients)
+        shed_output();
+    if (memory_counters.used > memory_counters.peak)
+        memory_counters.peak = memory_counters.used;
+    if (memory_counters.used > memory_budget)
+        enforce_memory_budget();
+    reap_clients();
+}
 
-            if (it->revents & POLLHUP) {
-                disconnect_client(it->fd);
-                break;
-            }
+void Server::charge_input(Client *client) {
+    const parse_state &p = client->parser;
+    size_t held = client->lexer.word.size() + p.tags.str().size() + p.prefix.value.size()
+        + p.command.size();
+    for (size_t i = 0; i < p.words.size(); ++i)
+        held += p.words[i].size();
+    charge(client, Client::memory_input, (ptrdiff_t)held - (ptrdiff_t)client->memory[Client::memory_input]);
+}
+
+void Server::over_memory_limit(Client *client) {
+    if (client->closing)
+        return;
+    client->set_quitting("Memory limit exceeded");
+    close_client(client);
+    memory_counters.limit_closes++;
+}
+
+// Closes the users holding the most until what stays is within the budget.
+// Links are left alone: closing one would split the network.
+void Server::enforce_memory_budget() {
+    std::vector<std::pair<size_t, Client *> > holders;
+    size_t estimate = memory_counters.used;
+    for (std::map<int, Client *>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        if (it->second->closing)
+            estimate -= it->second->memory_total;
+        else if (it->second->kind == Client::user)
+            holders.push_back(std::make_pair(it->second->memory_total, it->second));
+    }
+    std::sort(holders.rbegin(), holders.rend());
+    for (size_t i = 0; i < holders.size() && estimate > memory_budget; ++i) {
+        estimate -= holders[i].first;
+        holders[i].second->set_quitting("Server memory budget exceeded");
+        close_client(holders[i].second);
+        memory_counters.budget_closes++;
+    }
+}
 
-            if (it->revents & POLLIN) {
-                if (it->fd == sock) {
-                    connect_client();
-                    break;
-                }
+bool Server::reads_paused(Client *client) const {
+    return overload.get_stage() >= Overload::limit_reads
+        && pending_output(client) > PAUSE_READ_OUTPUT;
+}
+
+size_t Server::pending_output(Client *client) const {
+    size_t pending = client->output.size() + client->compressed.size();
+    if (uring)
+        pending += uring->in_flight(client->get_fd());
+    return pending;
+}
+
+// Disconnects the clients holding the most output until the queues are
+// back under the shedding target. Bytes already handed to io_uring are
+// only given back when their sends complete, so the loop keeps its own
+// estimate instead of watching output_bytes.
+void Server::shed_output() {
+    std::vector<std::pair<size_t, int> > holders;
+    for (std::map<int, Client *>::iterator it = clients.begin(); it != clients.end(); ++it)
+        holders.push_back(std::make_pair(pending_output(it->second), it->first));
+    std::sort(holders.rbegin(), holders.rend());
+
+    size_t estimate = output_bytes;
+    for (size_t i = 0; i < holders.size() && estimate > Overload::shed_target(); ++i) {
+        if (holders[i].first < SHED_MIN_OUTPUT)
+            break;
+        estimate -= holders[i].first;
+        Client *client = clients[holders[i].second];
+        if (client->closing)
+            continue;
+        client->set_quitting("Output queue overflow");
+        close_client(client);
+        overload.count_shed_client();
+    }
+}
+
+void Server::poll_once(int timeout) {
+    output_ready.clear();
+    // While overloaded, wake up now and then even when idle, so the stage
+    // can go back down and accepts resume.
+    if (overload.get_stage() != Overload::normal && (timeout < 0 || timeout > 100))
+        timeout = 100;
+    // Records OpenSSL already decrypted do not make the socket readable.
+    std::vector<size_t> decrypted;
+    for (size_t i = 0; i < fds.size(); ++i) {
+        fds[i].revents = 0;
+        if (fds[i].fd == sock || fds[i].fd == tls_sock) {
+            fds[i].events = overload.accepting() ? POLLIN : 0;
+            continue;
+        }
+        Client *client = clients[fds[i].fd];
+        if (client->tls && !client->tls->is_established()) {
+            fds[i].events = client->tls->wants_write() ? POLLOUT : POLLIN;
+            continue;
+        }
+        fds[i].events = reads_paused(client) ? 0 : POLLIN;
+        if (!client->output.empty() || !client->compressed.empty())
+            fds[i].events |= POLLOUT;
+        if (client->tls && fds[i].events & POLLIN && client->tls->has_pending())
+            decrypted.push_back(i);
+    }
+    if (!decrypted.empty() || tasks_runnable())
+        timeout = 0;
+
+    if (poll(&fds[0], fds.size(), timeout) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        throw std::runtime_error("Error while polling from fd!");
+    }
+    uint64_t start = monotonic_nanoseconds();
+    for (size_t i = 0; i < decrypted.size(); ++i)
+        fds[decrypted[i]].revents |= POLLIN;
+
+    // Accepts append to fds and closes wait for end_iteration(), so the
+    // whole ready set is handled in one pass. Entries are copied, since an
+    // accept may move the vector.
+    size_t polled = fds.size();
+    for (size_t i = 0; i < polled; ++i) {
+        pollfd ready = fds[i];
+        if (ready.revents == 0) {
+            continue;
+        }
+
+        if (ready.fd == sock || ready.fd == tls_sock) {
+            if (ready.revents & POLLIN)
+                connect_client(ready.fd);
+            continue;
+        }
+
+        Client *client = clients[ready.fd];
+        if (client->closing)
+            continue;
+        if ((ready.revents & (POLLHUP | POLLERR)) && !(ready.revents & POLLIN)) {
+            close_client(client);
+            continue;
+        }
+
+        if (client->tls && !client->tls->is_established()) {
+            if (!tls_handshake(client))
+                close_client(client);
+            continue;
+        }
+
+        if (ready.revents & POLLOUT) {
+            if (!flush_client(client)) {
+                close_client(client);
+                continue;
             }
-            handle_client_message(it->fd);
         }
+
+        if (ready.revents & POLLIN)
+            handle_client_message(ready.fd);
     }
+    end_iteration(monotonic_nanoseconds() - start);
 }
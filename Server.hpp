@@ -9,33 +9,444 @@
 #include <sys/poll.h>
 #include <vector>
 #include <netdb.h>
+#include <list>
 #include <map>
+#include <stddef.h>
+#include <stdint.h>
 #include "Client.hpp"
 #include <unistd.h>
+#include <csignal>
 #include "Channel.hpp"
 #include "Parser.hpp"
+#include "Capture.hpp"
+#include "ChannelLog.hpp"
+#include "CidrTrie.hpp"
+#include "History.hpp"
+#include "Overload.hpp"
+#include "Tls.hpp"
+#include "UringLoop.hpp"
 #define MAX_CLIENTS 100
+#define READ_BUFFER_SIZE 4096
+// Live connections allowed from one address and from one IPv4 /24 or
+// IPv6 /64.
+#define MAX_CLIENTS_PER_ADDRESS 10
+#define MAX_CLIENTS_PER_SUBNET 50
+// What a local user may hold before it is disconnected, and what all
+// clients together may hold before the largest users are; see charge().
+#define CLIENT_MEMORY_LIMIT (16 * 1024 * 1024)
+#define MEMORY_BUDGET ((size_t)1024 * 1024 * 1024)
+// One channel membership: a node in the client's channel set, a slot in
+// the channel's member list and one for its WHO line, plus the name.
+#define MEMBERSHIP_BYTES 96
+// Clients listed by MEMORY without a count.
+#define MEMORY_TOP_CLIENTS 10
+// Entries (channels, members, nicks) a task handles before it yields, and
+// how long tasks may run in one loop iteration before it goes back to the
+// sockets. A task waits while its client has TASK_PAUSE_OUTPUT queued.
+#define TASK_QUANTUM 64
+#define TASK_BUDGET_NANOSECONDS (1000 * 1000)
+#define TASK_PAUSE_OUTPUT (64 << 10)
+// Tasks a client may have waiting behind the one it is running.
+#define TASK_QUEUE_LIMIT 8
+// Bytes of nicks in one RPL_NAMREPLY, so the line stays under 512.
+#define NAMES_LINE_BYTES 400
+
+class Server;
+typedef void (Server::*command_handler)(Client *client, const message &m);
+struct task;
+typedef bool (Server::*task_step)(task &t);
+
+// A server this one links with, from the IRCSERV_LINKS file.
+struct link_config {
+	std::string     name;
+	std::string     address;
+	std::string     port;
+	std::string     password;
+	bool            autoconnect;
+};
+
+// Servers on the network, other than this one.
+struct server_info {
+	Client          *via;   // The link it is reached through.
+	unsigned        hops;
+	std::string     description;
+};
+
+struct link_stats {
+	unsigned long   bursts;
+	unsigned long   burst_lines;
+	unsigned long   burst_bytes;
+	unsigned long   netsplits;
+	unsigned long   split_users; // Remote users lost in netsplits.
+	// Channel messages relayed, one per link, and the bytes one copy per
+	// remote member would have added.
+	unsigned long   relayed;
+	unsigned long   relay_bytes_saved;
+	// Lines queued to links and the writes that carried them.
+	unsigned long   link_lines;
+	unsigned long   link_writes;
+};
+
+struct compression_stats {
+	unsigned long   clients;    // Connections that turned it on.
+	unsigned long   batches;
+	uint64_t        bytes_in;
+	uint64_t        bytes_out;
+	uint64_t        nanoseconds;
+};
+
+struct tls_stats {
+	unsigned long   handshakes;
+	unsigned long   failed_handshakes;
+	// Handshakes after which the kernel took over each direction.
+	unsigned long   kernel_send;
+	unsigned long   kernel_recv;
+};
+
+struct memory_stats {
+	size_t          used;
+	size_t          peak;
+	unsigned long   limit_closes;   // Users over CLIENT_MEMORY_LIMIT.
+	unsigned long   budget_closes;  // Users closed to get under MEMORY_BUDGET.
+};
+
+// A reply too long to build in one go: LIST, NAMES and WHO walk channels
+// and users TASK_QUANTUM entries at a time; see Tasks.cpp. A step returns
+// false once it has sent the end of the reply, and keeps in the task what
+// the next one needs. Walks go by name, not by iterator or pointer, so
+// channels and users may come and go between steps.
+struct task {
+	task_step       step;
+	Client          *client;
+	// Channels, or the WHO mask and flags, as given.
+	std::vector<std::string> targets;
+	size_t          target;
+	// Folded name of the last channel or nick sent, in walks of the
+	// whole server, or the next member of the current channel.
+	std::string     cursor;
+	size_t          member;
+	// The RPL_NAMREPLY being filled.
+	std::string     names;
+	unsigned long   steps;
+};
+
+struct task_stats {
+	unsigned long   started;
+	// Tasks that did not finish in their first step and were queued.
+	unsigned long   deferred;
+	unsigned long   steps;
+	// Iterations that ran out of TASK_BUDGET_NANOSECONDS with work left.
+	unsigned long   budget_stops;
+	// The most steps one task took.
+	unsigned long   most_steps;
+	// Tasks that waited for the client's previous one to finish.
+	unsigned long   waited;
+	// Commands refused with RPL_TRYAGAIN while the client had
+	// TASK_QUEUE_LIMIT tasks waiting.
+	unsigned long   refused;
+	uint64_t        nanoseconds;
+};
+
+// Entries of LIST and of WHO <channel> replies sent from the channels'
+// cached text, and those that had to be built first.
+struct reply_cache_stats {
+	unsigned long   list_hits;
+	unsigned long   list_misses;
+	unsigned long   who_hits;
+	unsigned long   who_misses;
+};
+
+struct closing_stats {
+	unsigned long   clients;
+	// Iterations that closed any, and the most one closed.
+	unsigned long   batches;
+	unsigned long   largest_batch;
+};
+
+// A line as each recipient should get it: with the sender's client-only
+// tags if the recipient enabled message-tags, with @time if it enabled
+// server-time. Variants are built when a recipient first needs them, so
+// recipients without capabilities get the line itself.
+class tagged_line {
+	private:
+		const std::string &line;
+		std::string     client_tags;
+		// TAGMSG: only recipients with message-tags get anything.
+		bool            tags_only;
+		std::string     time;
+		std::string     variants[4];
+
+	public:
+		tagged_line(const std::string &line, const std::string &client_tags, bool tags_only);
+		// Empty when the client gets nothing.
+		const std::string &for_client(const Client *client);
+		const std::string &get_line() const;
+		bool    is_tags_only() const;
+};
+
+// Time spent in a command's handler, collected when command stats are on.
+struct command_stat {
+	unsigned long   count;
+	uint64_t        total_nanoseconds;
+	uint64_t        max_nanoseconds;
+};
 
 class Server {
-	private:    
+	friend class UringLoop;
+	private:
         int	running;
         int sock;
 		const std::string       port;
-		const std::string       host;
+		// This server's name, also the prefix of its replies.
+		std::string             host;
 		const std::string       pass;
         std::vector<pollfd>     fds;
 		std::map<int, Client *> clients;
-		std::vector<Client> 	channels;
+		// Both keyed by fold_name() of the name.
+		std::map<std::string, Client *>     nicknames;
+		std::map<std::string, Channel *>    channels;
+		std::map<std::string, command_handler> commands;
+		// What links may send; see Links.cpp.
+		std::map<std::string, command_handler> link_commands;
+		std::map<std::string, link_config>  link_configs;
+		std::map<std::string, server_info>  servers;
+		// Outgoing links that have not got the peer's SERVER yet.
+		std::map<int, std::string>          connecting;
+		link_stats              link_counters;
+		// Descriptors of clients given to close_client() this iteration.
+		std::vector<int>        closing;
+		closing_stats           closing_counters;
+		// Queued tasks, at most one per client, in the order they get
+		// their next step.
+		std::list<task>         tasks;
+		// Each client's tasks that have not started yet, in the order
+		// the commands came.
+		std::map<Client *, std::list<task> > waiting_tasks;
+		task_stats              task_counters;
+		reply_cache_stats       reply_cache_counters;
+		size_t                  client_memory_limit;
+		size_t                  memory_budget;
+		memory_stats            memory_counters;
+		// Who may OPER, from set_oper(); nobody when the password is empty.
+		std::string             oper_name;
+		std::string             oper_password;
+		// user@host masks refused at registration.
+		MaskSet                 klines;
+		// Prefixes refused at accept, before a Client exists.
+		CidrTrie                dlines;
+		// Live connections per address (/128) and per subnet.
+		CidrTrie                connection_counts;
+		// Prefixes the per-address and per-subnet caps do not apply to.
+		CidrTrie                exemptions;
+		std::map<int, ip_address> client_addresses;
+		Capture                 *capture;
+		// Everything broadcast to channels, when enabled. It and history
+		// know channels by their folded names, like `channels` does.
+		ChannelLog              *channel_log;
+		UringLoop               *uring;
+		bool                    prefer_uring;
+		// Clients whose output went from empty to non-empty, for the
+		// io_uring loop to start sends on.
+		std::vector<int>        output_ready;
+		// What the poll loop reads into. Reads are parsed before the
+		// next one, so one buffer serves every client.
+		char                    read_buffer[READ_BUFFER_SIZE];
+		bool                    measure_commands;
+		// Bytes queued for clients that the kernel has not taken yet.
+		size_t                  output_bytes;
+		Overload                overload;
+		// PRIVMSG and NOTICE lines sent to channels.
+		History                 history;
+		std::map<std::string, command_stat> command_stats;
+		compression_stats       compression;
+		// The TLS port, when enabled.
+		int                     tls_sock;
+		TlsContext              *tls_context;
+		tls_stats               tls_counters;
+
+		void    dispatch(Client *client, message &m);
+		bool    dispatch_all(Client *client, std::vector<message> &messages);
+		void    send_to(Client *client, const std::string &line);
+		void    reply(Client *client, const std::string &numeric);
+		void    broadcast(Channel *channel, const std::string &line, Client *except);
+		void    broadcast(Channel *channel, tagged_line &line, Client *except);
+		bool    flush_client(Client *client);
+		// recv() and send(), through OpenSSL where kTLS is not on.
+		ssize_t read_socket(Client *client, char *buffer, size_t size);
+		ssize_t write_socket(Client *client, const char *data, size_t size);
+		bool    tls_handshake(Client *client);
+		// Moves a compressing client's output into client->compressed.
+		void    compress_output(Client *client);
+		void    try_register(Client *client);
+		bool    admit(int fd, const sockaddr *addr);
+		// Called by both loops after each iteration.
+		void    end_iteration(uint64_t busy_nanoseconds);
+		// Tears down one client but leaves its entry in fds.
+		void    release_client(int fd);
+		void    reap_clients();
+		// LIST, NAMES and WHO replies (Tasks.cpp).
+		void    start_task(Client *client, task_step step, const std::string &command,
+		                   const std::vector<std::string> &targets);
+		void    begin_task(task &t);
+		// Begins the client's waiting tasks in order until one is left
+		// with more steps to take.
+		void    start_waiting_tasks(Client *client);
+		// Steps tasks until they are done or the budget is spent; returns
+		// the time it took.
+		uint64_t run_tasks();
+		void    drop_task(Client *client);
+		bool    list_step(task &t);
+		bool    names_step(task &t);
+		bool    who_step(task &t);
+		std::string who_entry(Client *user, const std::string &channel, bool admin);
+		// Empties the user's cached WHO lines after it changed.
+		void    forget_who_entries(Client *user);
+		// Accounts for output appended to client->output directly, past
+		// its first `before` bytes, as send_to() does for a line.
+		void    count_output(Client *client, size_t before);
+		void    charge(Client *client, Client::memory_kind kind, ptrdiff_t bytes);
+		// Charges the part of a line the lexer and parser hold.
+		void    charge_input(Client *client);
+		void    over_memory_limit(Client *client);
+		void    enforce_memory_budget();
+		size_t  pending_output(Client *client) const;
+		bool    reads_paused(Client *client) const;
+		void    shed_output();
+		void    release_address(int fd);
+		void    part_channel(Client *client, Channel *channel);
+		// Local users sharing a channel with client, client excluded.
+		void    notify_peers(Client *client, const std::string &line);
+		void    replay_history(Client *client, const std::string &channel, size_t limit);
+
+		void    cmd_pass(Client *client, const message &m);
+		void    cmd_nick(Client *client, const message &m);
+		void    cmd_user(Client *client, const message &m);
+		void    cmd_ping(Client *client, const message &m);
+		void    cmd_pong(Client *client, const message &m);
+		void    cmd_quit(Client *client, const message &m);
+		void    cmd_join(Client *client, const message &m);
+		void    cmd_part(Client *client, const message &m);
+		void    cmd_privmsg(Client *client, const message &m);
+		void    cmd_notice(Client *client, const message &m);
+		void    cmd_mode(Client *client, const message &m);
+		void    cmd_chathistory(Client *client, const message &m);
+		void    cmd_server(Client *client, const message &m);
+		void    cmd_connect(Client *client, const message &m);
+		void    cmd_compress(Client *client, const message &m);
+		void    cmd_cap(Client *client, const message &m);
+		void    cmd_tagmsg(Client *client, const message &m);
+		void    cmd_oper(Client *client, const message &m);
+		void    cmd_memory(Client *client, const message &m);
+		void    cmd_list(Client *client, const message &m);
+		void    cmd_names(Client *client, const message &m);
+		void    cmd_who(Client *client, const message &m);
+
+		// Server links (Links.cpp).
+		void    connect_link(const link_config &config);
+		void    send_handshake(Client *link, const link_config &config);
+		void    send_burst(Client *link);
+		void    propagate(const std::string &line, Client *except);
+		void    relay(Channel *channel, const std::string &line, Client *except);
+		std::string introduction(Client *user, unsigned hops) const;
+		Client  *remote_source(Client *link, const message &m);
+		void    remove_remote_user(Client *user, const std::string &quit);
+		void    split_servers(Client *link, const std::vector<std::string> &names, const std::string &reason);
+		void    netsplit(Client *link);
+		bool    join_remote(Client *user, const std::string &name);
+		void    kill_user(Client *user, const std::string &reason);
+		void    dispatch_link(Client *link, message &m);
+		void    link_ping(Client *link, const message &m);
+		void    link_error(Client *link, const message &m);
+		void    link_server(Client *link, const message &m);
+		void    link_squit(Client *link, const message &m);
+		void    link_nick(Client *link, const message &m);
+		void    link_quit(Client *link, const message &m);
+		void    link_kill(Client *link, const message &m);
+		void    link_join(Client *link, const message &m);
+		void    link_njoin(Client *link, const message &m);
+		void    link_part(Client *link, const message &m);
+		void    link_text(Client *link, const message &m);
+		void    link_mode(Client *link, const message &m);
+		void    send_text(Client *client, const message &m, const std::string &command);
 	public:
+		// Set from SIGINT/SIGTERM; start() returns once it sees it, so
+		// profiling builds get to write their data on exit.
+		static volatile sig_atomic_t signaled;
+		static void handle_signal(int signal);
+
 		Server(const std::string &port, const std::string &pass);
 		~Server();
-		int		initialize_socket();
+		int		initialize_socket(const std::string &port);
 		void	start();
+		// One poll() and one pass over the ready descriptors.
+		void	poll_once(int timeout);
+		// Right away; only safe outside the loops' pass over clients.
 		void	disconnect_client(int fd);
-		void	connect_client();
-		void    handle_client_message(int fd);
-		struct message get_client_message(int fd);
+		// Marks the client for closing at the end of the iteration.
+		void	close_client(Client *client);
+		void	connect_client(int listener);
+		// Takes ownership of an already connected socket.
+		Client	*add_client(int fd, int port, const std::string &hostname);
+		Client	*accept_client(int fd, const sockaddr *addr, socklen_t size);
+		// Feeds bytes read from a client through parse and dispatch.
+		// Returns false when the client got disconnected.
+		bool	receive(Client *client, const char *data, size_t size);
+		size_t	client_count() const;
+		// Bytes queued for clients and not yet taken by the kernel.
+		size_t	queued_output() const;
+		bool    handle_client_message(int fd);
+		// Reads into read_buffer and parses what came in.
+		std::vector<message> get_client_message(Client *client);
 
+		void	enable_capture(const std::string &path);
+		// The name this server goes by on the network.
+		void	set_name(const std::string &name);
+		// One link per line: <name> <address> <port> <password>, and
+		// `autoconnect` to connect at startup. Empty lines and lines
+		// starting with '#' are skipped.
+		void	load_links(const std::string &path);
+		const link_stats &get_link_stats() const;
+		// Listens for TLS on port as well. Without a certificate, a
+		// self-signed one is made up.
+		void	enable_tls(const std::string &port, const std::string &certificate,
+				   const std::string &key);
+		// Logs channel traffic into segment files under directory.
+		void	enable_log(const std::string &directory);
+		// One user@host mask per line; empty lines and lines starting
+		// with '#' are skipped.
+		void	load_klines(const std::string &path);
+		// One address or CIDR prefix per line, same format.
+		void	load_dlines(const std::string &path);
+		void	load_exemptions(const std::string &path);
+		// start() uses io_uring when the kernel supports it, unless told
+		// to stick to poll.
+		void	use_poll();
+		void	enable_command_stats();
+		const std::map<std::string, command_stat> &get_command_stats() const;
+		const Overload::stats &get_overload_stats() const;
+		const History::stats &get_history_stats() const;
+		const compression_stats &get_compression_stats() const;
+		const tls_stats &get_tls_stats() const;
+		const closing_stats &get_closing_stats() const;
+		const task_stats &get_task_stats() const;
+		const reply_cache_stats &get_reply_cache_stats() const;
+		// A task that can take a step: the loops do not block while there
+		// is one.
+		bool	tasks_runnable() const;
+		void	set_memory_limits(size_t client_limit, size_t budget);
+		const memory_stats &get_memory_stats() const;
+		// OPER <name> <password> makes a client an operator.
+		void	set_oper(const std::string &name, const std::string &password);
+		// NULL unless the channel log is enabled.
+		const ChannelLog::stats *get_log_stats() const;
+};
 
-		
-};
\ No newline at end of file
+// Called wherever a client's holdings change, so it stays a few
+// instructions; going over the limit is handled out of line.
+inline void Server::charge(Client *client, Client::memory_kind kind, ptrdiff_t bytes) {
+	client->memory[kind] += bytes;
+	client->memory_total += bytes;
+	memory_counters.used += bytes;
+	if (client->memory_total > client_memory_limit && client->kind == Client::user)
+		over_memory_limit(client);
+}
@@ -0,0 +1,303 @@
+#include "Server.hpp"
+#include "Clock.hpp"
+#include "IRCResponse.hpp"
+#include "Text.hpp"
+#include <algorithm>
+
+// LIST, NAMES and WHO. On a big server their replies run to thousands of
+// lines, and building one inside its handler would hold up every other
+// client until it is done. Each is a task instead: the handler runs the
+// first step, which is the whole reply when it is short, and queues the
+// task only if there is more. After every loop iteration run_tasks() gives
+// the queued tasks a step each in turn, for as many rounds as fit in
+// TASK_BUDGET_NANOSECONDS, and the loops do not block while any is left.
+//
+// A client runs one task at a time. Another LIST, NAMES or WHO meanwhile
+// waits in the client's queue and begins when the ones before it are done,
+// so pipelined commands get their replies in order; past TASK_QUEUE_LIMIT
+// waiting it gets RPL_TRYAGAIN. The client's other commands are handled as
+// usual, so their replies may come in the middle of the long one.
+//
+// Bots ask for LIST and WHO <channel> over and over, and most of each
+// reply is the same every time. Channels keep the text of their 322 line
+// and of their members' 352 lines, all but the ":<server> 322 <nick> " in
+// front, and the steps append it to the client's output as it is. JOIN and
+// PART empty the entries they change, as do nick changes, OPER and a new
+// channel admin; only those are built again.
+
+void Server::start_task(Client *client, task_step step, const std::string &command,
+                        const std::vector<std::string> &targets) {
+    std::list<task> *waiting = NULL;
+    if (client->has_task) {
+        waiting = &waiting_tasks[client];
+        if (waiting->size() >= TASK_QUEUE_LIMIT) {
+            reply(client, IRCResponse::RPL_TRYAGAIN(client->get_nickname(), command));
+            task_counters.refused++;
+            return;
+        }
+    }
+    task t;
+    t.step = step;
+    t.client = client;
+    t.targets = targets;
+    t.target = 0;
+    t.member = 0;
+    t.steps = 0;
+    if (!waiting) {
+        begin_task(t);
+        return;
+    }
+    waiting->push_back(t);
+    task_counters.waited++;
+}
+
+// Takes the first step of t, and queues it if there are more.
+void Server::begin_task(task &t) {
+    t.steps = 1;
+    task_counters.started++;
+    task_counters.steps++;
+    if (!(this->*t.step)(t)) {
+        task_counters.most_steps = std::max(task_counters.most_steps, t.steps);
+        return;
+    }
+    t.client->has_task = true;
+    tasks.push_back(t);
+    task_counters.deferred++;
+}
+
+void Server::start_waiting_tasks(Client *client) {
+    std::map<Client *, std::list<task> >::iterator it = waiting_tasks.find(client);
+    while (it != waiting_tasks.end() && !client->has_task) {
+        task t = it->second.front();
+        it->second.pop_front();
+        if (it->second.empty()) {
+            waiting_tasks.erase(it);
+            it = waiting_tasks.end();
+        }
+        begin_task(t);
+    }
+}
+
+uint64_t Server::run_tasks() {
+    if (tasks.empty())
+        return 0;
+    uint64_t start = monotonic_nanoseconds();
+    uint64_t now = start;
+    std::list<task>::iterator it = tasks.begin();
+    bool stepped = true;
+    while (stepped && now - start < TASK_BUDGET_NANOSECONDS) {
+        stepped = false;
+        it = tasks.begin();
+        while (it != tasks.end() && now - start < TASK_BUDGET_NANOSECONDS) {
+            Client *client = it->client;
+            if (client->closing || pending_output(client) > TASK_PAUSE_OUTPUT) {
+                ++it;
+                continue;
+            }
+            stepped = true;
+            it->steps++;
+            task_counters.steps++;
+            if ((this->*it->step)(*it)) {
+                ++it;
+            } else {
+                client->has_task = false;
+                task_counters.most_steps = std::max(task_counters.most_steps, it->steps);
+                it = tasks.erase(it);
+                // A task begun here goes to the back and gets its next
+                // step later in this pass or the next one.
+                start_waiting_tasks(client);
+            }
+            now = monotonic_nanoseconds();
+        }
+    }
+    // The tasks the budget cut off go first next time.
+    tasks.splice(tasks.end(), tasks, tasks.begin(), it);
+    if (stepped && tasks_runnable())
+        task_counters.budget_stops++;
+    task_counters.nanoseconds += now - start;
+    return now - start;
+}
+
+bool Server::tasks_runnable() const {
+    for (std::list<task>::const_iterator it = tasks.begin(); it != tasks.end(); ++it) {
+        if (!it->client->closing && pending_output(it->client) <= TASK_PAUSE_OUTPUT)
+            return true;
+    }
+    return false;
+}
+
+void Server::drop_task(Client *client) {
+    if (!client->has_task)
+        return;
+    waiting_tasks.erase(client);
+    for (std::list<task>::iterator it = tasks.begin(); it != tasks.end(); ++it) {
+        if (it->client == client) {
+            tasks.erase(it);
+            break;
+        }
+    }
+    client->has_task = false;
+}
+
+// Every channel when no targets are given, in folded name order.
+bool Server::list_step(task &t) {
+    std::string &output = t.client->output;
+    size_t before = output.size();
+    std::string head = ":" + host + " 322 " + t.client->get_nickname() + " ";
+    std::vector<Channel *> listed;
+    bool more;
+    if (t.targets.empty()) {
+        std::map<std::string, Channel *>::iterator it = channels.upper_bound(t.cursor);
+        for (size_t n = 0; n < TASK_QUANTUM && it != channels.end(); ++n, ++it)
+            listed.push_back(it->second);
+        more = it != channels.end();
+        if (more)
+            t.cursor = (--it)->first;
+    } else {
+        for (size_t n = 0; n < TASK_QUANTUM && t.target < t.targets.size(); ++n, ++t.target) {
+            std::map<std::string, Channel *>::iterator it = channels.find(fold_name(t.targets[t.target]));
+            if (it != channels.end())
+                listed.push_back(it->second);
+        }
+        more = t.target < t.targets.size();
+    }
+    for (size_t i = 0; i < listed.size(); ++i) {
+        Channel *channel = listed[i];
+        if (channel->list_entry.empty()) {
+            channel->list_entry = IRCResponse::RPL_LIST(channel->get_name(), channel->size());
+            reply_cache_counters.list_misses++;
+        } else {
+            reply_cache_counters.list_hits++;
+        }
+        output += head;
+        output += channel->list_entry;
+        output += "\r\n";
+    }
+    count_output(t.client, before);
+    if (more)
+        return true;
+    reply(t.client, IRCResponse::RPL_LISTEND(t.client->get_nickname()));
+    return false;
+}
+
+// Members are walked by index, so someone who joins or parts between two
+// steps may be left out or listed twice.
+bool Server::names_step(task &t) {
+    const std::string &nick = t.client->get_nickname();
+    size_t quantum = TASK_QUANTUM;
+    for (; t.target < t.targets.size(); ++t.target, t.member = 0) {
+        if (quantum == 0)
+            return true;
+        --quantum;
+        std::map<std::string, Channel *>::iterator it = channels.find(fold_name(t.targets[t.target]));
+        if (it == channels.end()) {
+            t.names.clear();
+            reply(t.client, IRCResponse::RPL_ENDOFNAMES(nick, t.targets[t.target]));
+            continue;
+        }
+        Channel *channel = it->second;
+        const std::vector<Client *> &members = channel->get_clients();
+        for (; t.member < members.size(); ++t.member) {
+            if (quantum == 0)
+                return true;
+            --quantum;
+            std::string entry = members[t.member] == channel->get_admin() ? "@" : "";
+            entry += members[t.member]->get_nickname();
+            if (!t.names.empty() && t.names.size() + 1 + entry.size() > NAMES_LINE_BYTES) {
+                reply(t.client, IRCResponse::RPL_NAMREPLY(nick, channel->get_name(), t.names));
+                t.names.clear();
+            }
+            if (!t.names.empty())
+                t.names += " ";
+            t.names += entry;
+        }
+        if (!t.names.empty())
+            reply(t.client, IRCResponse::RPL_NAMREPLY(nick, channel->get_name(), t.names));
+        t.names.clear();
+        reply(t.client, IRCResponse::RPL_ENDOFNAMES(nick, channel->get_name()));
+    }
+    return false;
+}
+
+std::string Server::who_entry(Client *user, const std::string &channel, bool admin) {
+    std::string server = host;
+    unsigned hops = 0;
+    if (user->kind == Client::remote_user) {
+        server = user->server;
+        std::map<std::string, server_info>::iterator it = servers.find(user->server);
+        hops = it != servers.end() ? it->second.hops : 1;
+    }
+    std::string flags = "H";
+    if (user->oper)
+        flags += "*";
+    if (admin)
+        flags += "@";
+    return IRCResponse::RPL_WHOREPLY(channel, user->get_username(), user->get_hostname(), server,
+                                     user->get_nickname(), flags, hops, user->get_realname());
+}
+
+void Server::forget_who_entries(Client *user) {
+    for (std::set<std::string>::iterator it = user->channels.begin(); it != user->channels.end(); ++it)
+        channels[*it]->forget_who_entry(user);
+}
+
+// WHO [<mask> [o]]: the members of a channel, or every user whose nick,
+// host, server or real name matches the mask, in folded nick order. With
+// `o`, operators only.
+bool Server::who_step(task &t) {
+    // "WHO", "WHO 0" and "WHO :" all ask for everyone.
+    std::string mask = t.targets.empty() ? "" : t.targets[0];
+    if (mask.empty() || mask == "0")
+        mask = "*";
+    bool opers_only = t.targets.size() > 1 && t.targets[1] == "o";
+    std::string &output = t.client->output;
+    size_t before = output.size();
+    std::string head = ":" + host + " 352 " + t.client->get_nickname() + " ";
+    bool more = false;
+    if (mask[0] == '#' || mask[0] == '&') {
+        std::map<std::string, Channel *>::iterator it = channels.find(fold_name(mask));
+        if (it != channels.end()) {
+            Channel *channel = it->second;
+            const std::vector<Client *> &members = channel->get_clients();
+            for (size_t n = 0; n < TASK_QUANTUM && t.member < members.size(); ++n, ++t.member) {
+                Client *user = members[t.member];
+                if (opers_only && !user->oper)
+                    continue;
+                std::string &entry = channel->who_entries[t.member];
+                if (entry.empty()) {
+                    entry = who_entry(user, channel->get_name(), user == channel->get_admin());
+                    reply_cache_counters.who_misses++;
+                } else {
+                    reply_cache_counters.who_hits++;
+                }
+                output += head;
+                output += entry;
+                output += "\r\n";
+            }
+            more = t.member < members.size();
+        }
+    } else {
+        std::map<std::string, Client *>::iterator it = nicknames.upper_bound(t.cursor);
+        for (size_t n = 0; n < TASK_QUANTUM && it != nicknames.end(); ++n, ++it) {
+            Client *user = it->second;
+            t.cursor = it->first;
+            if ((user->kind == Client::user && !user->is_registered()) || (opers_only && !user->oper))
+                continue;
+            const std::string &server = user->kind == Client::remote_user ? user->server : host;
+            if (mask == "*" || MaskSet::match(mask, user->get_nickname())
+                || MaskSet::match(mask, user->get_hostname()) || MaskSet::match(mask, server)
+                || MaskSet::match(mask, user->get_realname())) {
+                output += head;
+                output += who_entry(user, "*", false);
+                output += "\r\n";
+            }
+        }
+        more = it != nicknames.end();
+    }
+    count_output(t.client, before);
+    if (more)
+        return true;
+    bool named = !t.targets.empty() && !t.targets[0].empty();
+    reply(t.client, IRCResponse::RPL_ENDOFWHO(t.client->get_nickname(), named ? t.targets[0] : "*"));
+    return false;
+}
@@ -0,0 +1,324 @@
+#include "Text.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TEXT_X86 1
+#include <immintrin.h>
+#endif
+
+bool valid_utf8_scalar(const char *data, size_t size) {
+	const unsigned char *s = reinterpret_cast<const unsigned char *>(data);
+	size_t i = 0;
+	while (i < size) {
+		unsigned char c = s[i];
+		if (c < 0x80) {
+			i++;
+			continue;
+		}
+		size_t length;
+		// The range of the second byte, narrower after E0, ED, F0 and F4.
+		unsigned char low = 0x80, high = 0xBF;
+		if (c >= 0xC2 && c <= 0xDF)
+			length = 2;
+		else if (c >= 0xE0 && c <= 0xEF) {
+			length = 3;
+			if (c == 0xE0)
+				low = 0xA0;
+			else if (c == 0xED)
+				high = 0x9F;
+		} else if (c >= 0xF0 && c <= 0xF4) {
+			length = 4;
+			if (c == 0xF0)
+				low = 0x90;
+			else if (c == 0xF4)
+				high = 0x8F;
+		} else
+			return false;
+		if (size - i < length || s[i + 1] < low || s[i + 1] > high)
+			return false;
+		for (size_t j = 2; j < length; j++)
+			if ((s[i + j] & 0xC0) != 0x80)
+				return false;
+		i += length;
+	}
+	return true;
+}
+
+void fold_name_scalar(const char *in, size_t size, char *out) {
+	for (size_t i = 0; i < size; i++) {
+		char c = in[i];
+		out[i] = c >= 'A' && c <= '^' ? c + ('a' - 'A') : c;
+	}
+}
+
+#ifdef TEXT_X86
+
+// UTF-8 validation after Keiser and Lemire, "Validating UTF-8 in less than
+// one instruction per byte". Each byte is looked up by its high nibble and
+// the previous byte by both nibbles; the three results share a bit for each
+// kind of error a two-byte window can show, so an error is a bit set in all
+// three. Third and fourth bytes of a sequence are checked separately
+// against the bytes two and three back.
+#define UTF8_TOO_SHORT (1 << 0)   // A lead byte without its continuation.
+#define UTF8_TOO_LONG (1 << 1)    // A continuation after ASCII.
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)   // Two continuations, fine if in a longer sequence.
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+static const unsigned char first_high[16] = {
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+	UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+	UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+	UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+static const unsigned char first_low[16] = {
+	UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+	UTF8_CARRY | UTF8_OVERLONG_2,
+	UTF8_CARRY,
+	UTF8_CARRY,
+	UTF8_CARRY | UTF8_TOO_LARGE,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const unsigned char second_high[16] = {
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+// Anything above these in the last three bytes of a block starts a
+// sequence that goes on in the next one.
+static const unsigned char incomplete_limit[32] = {
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xEF, 0xDF, 0xBF,
+};
+
+__attribute__((target("ssse3")))
+static __m128i utf8_errors_ssse3(__m128i input, __m128i previous) {
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+	__m128i special = _mm_and_si128(
+	    _mm_and_si128(
+		_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(first_high)),
+				 _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+		_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(first_low)),
+				 _mm_and_si128(prev1, nibble))),
+	    _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(second_high)),
+			     _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+	__m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 14), _mm_set1_epi8(0xE0 - 0x80));
+	__m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 13), _mm_set1_epi8(0xF0 - 0x80));
+	__m128i expected = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(static_cast<char>(0x80)));
+	return _mm_xor_si128(expected, special);
+}
+
+__attribute__((target("ssse3")))
+static bool valid_utf8_ssse3(const char *data, size_t size) {
+	const __m128i limit = _mm_loadu_si128(reinterpret_cast<const __m128i *>(incomplete_limit + 16));
+	__m128i previous = _mm_setzero_si128();
+	__m128i error = _mm_setzero_si128();
+	__m128i incomplete = _mm_setzero_si128();
+	// The last block is padded with zeros, which end any open sequence.
+	for (size_t i = 0;; i += 16) {
+		bool last = size - i < 16;
+		__m128i input;
+		if (last) {
+			char block[16] = {0};
+			memcpy(block, data + i, size - i);
+			input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+		} else
+			input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+		if (_mm_movemask_epi8(input) == 0)
+			error = _mm_or_si128(error, incomplete);
+		else {
+			error = _mm_or_si128(error, utf8_errors_ssse3(input, previous));
+			incomplete = _mm_subs_epu8(input, limit);
+		}
+		previous = input;
+		if (last)
+			break;
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+// The bytes before each byte of input, across the two 128-bit lanes.
+#define AVX2_PREVIOUS(input, previous, n) \
+	_mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static __m256i utf8_errors_avx2(__m256i input, __m256i previous) {
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	__m256i prev1 = AVX2_PREVIOUS(input, previous, 1);
+	__m256i special = _mm256_and_si256(
+	    _mm256_and_si256(
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(first_high))),
+				    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(first_low))),
+				    _mm256_and_si256(prev1, nibble))),
+	    _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(second_high))),
+				_mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+	__m256i third = _mm256_subs_epu8(AVX2_PREVIOUS(input, previous, 2), _mm256_set1_epi8(0xE0 - 0x80));
+	__m256i fourth = _mm256_subs_epu8(AVX2_PREVIOUS(input, previous, 3), _mm256_set1_epi8(0xF0 - 0x80));
+	__m256i expected = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+	return _mm256_xor_si256(expected, special);
+}
+
+__attribute__((target("avx2")))
+static bool valid_utf8_avx2(const char *data, size_t size) {
+	const __m256i limit = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(incomplete_limit));
+	__m256i previous = _mm256_setzero_si256();
+	__m256i error = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+	for (size_t i = 0;; i += 32) {
+		bool last = size - i < 32;
+		__m256i input;
+		if (last) {
+			char block[32] = {0};
+			memcpy(block, data + i, size - i);
+			input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+		} else
+			input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+		if (_mm256_movemask_epi8(input) == 0)
+			error = _mm256_or_si256(error, incomplete);
+		else {
+			error = _mm256_or_si256(error, utf8_errors_avx2(input, previous));
+			incomplete = _mm256_subs_epu8(input, limit);
+		}
+		previous = input;
+		if (last)
+			break;
+	}
+	return _mm256_testz_si256(error, error);
+}
+
+// Bytes from 'A' to '^' get 0x20 added. Bytes above 0x7F are negative
+// when compared as signed and stay as they are.
+static __m128i fold_sse2(__m128i c) {
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)),
+				      _mm_cmplt_epi8(c, _mm_set1_epi8('^' + 1)));
+	return _mm_add_epi8(c, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+
+static void fold_name_sse2(const char *in, size_t size, char *out) {
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+				 fold_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i))));
+	// Copying the rest into a padded block costs more than it saves.
+	fold_name_scalar(in + i, size - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void fold_name_avx2(const char *in, size_t size, char *out) {
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+		__m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)),
+						 _mm256_cmpgt_epi8(_mm256_set1_epi8('^' + 1), c));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+				    _mm256_add_epi8(c, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A'))));
+	}
+	// Names are mostly shorter than 32 bytes.
+	fold_name_sse2(in + i, size - i, out + i);
+}
+
+#endif
+
+struct text_kernels {
+	bool (*utf8)(const char *data, size_t size);
+	void (*fold)(const char *in, size_t size, char *out);
+};
+
+static text_kernels kernels_for(text_kernel kernel) {
+	text_kernels k;
+	k.utf8 = valid_utf8_scalar;
+	k.fold = fold_name_scalar;
+#ifdef TEXT_X86
+	if (kernel == text_ssse3) {
+		k.utf8 = valid_utf8_ssse3;
+		k.fold = fold_name_sse2;
+	} else if (kernel == text_avx2) {
+		k.utf8 = valid_utf8_avx2;
+		k.fold = fold_name_avx2;
+	}
+#else
+	(void)kernel;
+#endif
+	return k;
+}
+
+text_kernel best_text_kernel() {
+#ifdef TEXT_X86
+	// Static initialisers may run before the library has probed the CPU.
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return text_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return text_ssse3;
+#endif
+	return text_scalar;
+}
+
+static text_kernel current = best_text_kernel();
+static text_kernels kernels = kernels_for(current);
+
+text_kernel get_text_kernel() {
+	return current;
+}
+
+void use_text_kernel(text_kernel kernel) {
+	current = kernel;
+	kernels = kernels_for(kernel);
+}
+
+const char *text_kernel_name(text_kernel kernel) {
+	switch (kernel) {
+	case text_ssse3:
+		return "ssse3";
+	case text_avx2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+bool valid_utf8(const char *data, size_t size) {
+	return kernels.utf8(data, size);
+}
+
+bool valid_utf8(const std::string &text) {
+	return kernels.utf8(text.data(), text.size());
+}
+
+void fold_name(const char *in, size_t size, char *out) {
+	kernels.fold(in, size, out);
+}
+
+std::string fold_name(const std::string &name) {
+	std::string folded(name.size(), '\0');
+	if (!name.empty())
+		kernels.fold(name.data(), name.size(), &folded[0]);
+	return folded;
+}
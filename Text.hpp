@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+// Byte kernels for text from clients: UTF-8 validation of parameters and
+// RFC 1459 casemapping of nicknames and channel names, which are folded
+// before every lookup in the name index. Both have vector versions for
+// x86-64, picked once at startup from what the CPU supports; the scalar
+// versions are the reference the tests compare them with.
+enum text_kernel {
+	text_scalar,
+	text_ssse3,  // 16 bytes at a time.
+	text_avx2,   // 32 bytes at a time.
+};
+
+text_kernel best_text_kernel();
+text_kernel get_text_kernel();
+// For tests and the benchmark; the kernel must be supported.
+void        use_text_kernel(text_kernel kernel);
+const char  *text_kernel_name(text_kernel kernel);
+
+// RFC 3629: no overlong forms, surrogates or code points above U+10FFFF.
+bool        valid_utf8(const char *data, size_t size);
+bool        valid_utf8(const std::string &text);
+bool        valid_utf8_scalar(const char *data, size_t size);
+
+// A-Z and []\^ to a-z and {}|~. out may be in.
+void        fold_name(const char *in, size_t size, char *out);
+std::string fold_name(const std::string &name);
+void        fold_name_scalar(const char *in, size_t size, char *out);
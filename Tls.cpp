@@ -0,0 +1,151 @@
+#include "Tls.hpp"
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <stdexcept>
+
+static SSL_CTX *new_context(bool kernel) {
+	SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+	if (!ctx)
+		throw std::runtime_error("Error: Unable to create a TLS context.");
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	// Output is sent from the front of a queue that grows and gets
+	// erased from, so a retried write may come from another address.
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_options(ctx, SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF);
+	if (kernel)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	return ctx;
+}
+
+TlsContext::TlsContext(SSL_CTX *ctx) : ctx(ctx) {
+}
+
+TlsContext::TlsContext(const std::string &certificate, const std::string &key, bool kernel)
+    : ctx(new_context(kernel)) {
+	if (SSL_CTX_use_certificate_chain_file(ctx, certificate.c_str()) != 1
+	    || SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM) != 1
+	    || SSL_CTX_check_private_key(ctx) != 1) {
+		SSL_CTX_free(ctx);
+		throw std::runtime_error("Error: Unable to load the TLS certificate " + certificate + " and key " + key);
+	}
+}
+
+TlsContext *TlsContext::self_signed(const std::string &name, bool kernel) {
+	TlsContext *context = new TlsContext(new_context(kernel));
+	EVP_PKEY *key = EVP_EC_gen("P-256");
+	X509 *certificate = X509_new();
+	bool made = key && certificate;
+	if (made) {
+		X509_set_version(certificate, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+		X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+		X509_gmtime_adj(X509_getm_notAfter(certificate), 365L * 24 * 60 * 60);
+		X509_set_pubkey(certificate, key);
+		X509_NAME *subject = X509_get_subject_name(certificate);
+		X509_NAME_add_entry_by_txt(subject, "CN", MBSTRING_ASC,
+					   reinterpret_cast<const unsigned char *>(name.c_str()), -1, -1, 0);
+		X509_set_issuer_name(certificate, subject);
+		made = X509_sign(certificate, key, EVP_sha256()) > 0
+		    && SSL_CTX_use_certificate(context->ctx, certificate) == 1
+		    && SSL_CTX_use_PrivateKey(context->ctx, key) == 1;
+	}
+	X509_free(certificate);
+	EVP_PKEY_free(key);
+	if (!made) {
+		delete context;
+		throw std::runtime_error("Error: Unable to make a self-signed TLS certificate.");
+	}
+	return context;
+}
+
+TlsContext::~TlsContext() {
+	SSL_CTX_free(ctx);
+}
+
+SSL *TlsContext::wrap(int fd) const {
+	SSL *ssl = SSL_new(ctx);
+	if (!ssl || SSL_set_fd(ssl, fd) != 1) {
+		SSL_free(ssl);
+		throw std::runtime_error("Error: Unable to start a TLS session.");
+	}
+	return ssl;
+}
+
+TlsSession::TlsSession(SSL *ssl)
+    : ssl(ssl), established(false), kernel_send(false), kernel_recv(false),
+      blocked_on_write(false) {
+}
+
+TlsSession::~TlsSession() {
+	SSL_free(ssl);
+}
+
+TlsSession::status TlsSession::check(int result) {
+	int error = SSL_get_error(ssl, result);
+	blocked_on_write = error == SSL_ERROR_WANT_WRITE;
+	switch (error) {
+	case SSL_ERROR_WANT_READ:
+		return want_read;
+	case SSL_ERROR_WANT_WRITE:
+		return want_write;
+	case SSL_ERROR_ZERO_RETURN:
+		return closed;
+	default:
+		return failed;
+	}
+}
+
+TlsSession::status TlsSession::handshake() {
+	ERR_clear_error();
+	int result = SSL_accept(ssl);
+	if (result != 1)
+		return check(result);
+	established = true;
+	blocked_on_write = false;
+	kernel_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+	kernel_recv = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+	return ok;
+}
+
+TlsSession::status TlsSession::read(char *buffer, size_t size, size_t &done) {
+	ERR_clear_error();
+	int result = SSL_read_ex(ssl, buffer, size, &done);
+	if (result != 1)
+		return check(result);
+	blocked_on_write = false;
+	return ok;
+}
+
+TlsSession::status TlsSession::write(const char *data, size_t size, size_t &done) {
+	ERR_clear_error();
+	int result = SSL_write_ex(ssl, data, size, &done);
+	if (result != 1)
+		return check(result);
+	blocked_on_write = false;
+	return ok;
+}
+
+bool TlsSession::is_established() const {
+	return established;
+}
+
+bool TlsSession::sends_in_kernel() const {
+	return kernel_send;
+}
+
+bool TlsSession::receives_in_kernel() const {
+	return kernel_recv;
+}
+
+bool TlsSession::wants_write() const {
+	return blocked_on_write;
+}
+
+bool TlsSession::has_pending() const {
+	return SSL_pending(ssl) > 0;
+}
+
+const char *TlsSession::cipher() const {
+	return SSL_get_cipher_name(ssl);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <openssl/ssl.h>
+#include <stddef.h>
+#include <string>
+
+// TLS for the second listening port. OpenSSL does the handshake on the
+// non-blocking socket, with SSL_OP_ENABLE_KTLS asking it to hand the record
+// keys to the kernel afterwards. Each direction the kernel took is plain
+// recv()/send() on the fd from then on, exactly as for a plaintext client;
+// a direction it refused (no tls module, a cipher it lacks, receive with a
+// TLS version OpenSSL cannot offload) goes through SSL_read()/SSL_write().
+// Roughly what OpenSSL holds per connection: the SSL object and a record
+// buffer each way.
+#define TLS_SESSION_BYTES (40 * 1024)
+
+class TlsContext {
+	private:
+		SSL_CTX *ctx;
+
+		explicit TlsContext(SSL_CTX *ctx);
+		TlsContext(const TlsContext &src);
+		TlsContext &operator=(const TlsContext &src);
+
+	public:
+		// PEM files. Without `kernel`, records are always encrypted in
+		// user space; the benchmark compares the two.
+		TlsContext(const std::string &certificate, const std::string &key, bool kernel = true);
+		~TlsContext();
+		// A fresh P-256 key and a self-signed certificate for `name`,
+		// for tests, benchmarks and trying TLS without a certificate.
+		static TlsContext *self_signed(const std::string &name, bool kernel = true);
+		SSL     *wrap(int fd) const;
+};
+
+class TlsSession {
+	public:
+		enum status {
+			ok,
+			want_read,
+			want_write,
+			closed,      // The peer closed the connection.
+			failed,
+		};
+
+	private:
+		SSL     *ssl;
+		bool    established;
+		bool    kernel_send;
+		bool    kernel_recv;
+		// The last call wants the socket writable before it can go on.
+		bool    blocked_on_write;
+
+		TlsSession(const TlsSession &src);
+		TlsSession &operator=(const TlsSession &src);
+		status  check(int result);
+
+	public:
+		// Takes ownership of ssl.
+		explicit TlsSession(SSL *ssl);
+		~TlsSession();
+		status  handshake();
+		// Like recv() and send(): `done` is the number of bytes moved
+		// when the status is ok.
+		status  read(char *buffer, size_t size, size_t &done);
+		status  write(const char *data, size_t size, size_t &done);
+		bool    is_established() const;
+		bool    sends_in_kernel() const;
+		bool    receives_in_kernel() const;
+		bool    wants_write() const;
+		// Decrypted bytes OpenSSL holds that the socket will not signal.
+		bool    has_pending() const;
+		const char *cipher() const;
+};
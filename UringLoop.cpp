@@ -0,0 +1,504 @@
+#include "UringLoop.hpp"
+#include "Clock.hpp"
+#include "Server.hpp"
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstdlib>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+#define URING_BATCH 64 // Completions handled per loop iteration.
+#define RECV_BUFFER_COUNT 512 // Power of two.
+#define RECV_BUFFER_SIZE 4096
+#define RECV_BUFFER_GROUP 0
+
+// user_data layout: serial << 32 | operation << 24 | fd.
+enum operation {
+	op_accept = 1,
+	op_recv = 2,
+	op_send = 3,
+	op_cancel = 4,
+	op_timeout = 5,
+};
+
+static uint64_t make_user_data(operation op, int fd, uint32_t serial) {
+	return (uint64_t)serial << 32 | (uint64_t)op << 24 | (uint32_t)fd;
+}
+
+static operation user_data_operation(uint64_t user_data) {
+	return (operation)((user_data >> 24) & 0xff);
+}
+
+static int user_data_fd(uint64_t user_data) {
+	return (int)(user_data & 0xffffff);
+}
+
+static uint32_t user_data_serial(uint64_t user_data) {
+	return (uint32_t)(user_data >> 32);
+}
+
+static int io_uring_setup(unsigned entries, io_uring_params *params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned count) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+// Multishot recv, the newest feature used, arrived in 6.0.
+static bool kernel_is_recent_enough() {
+	utsname name;
+	if (uname(&name) != 0)
+		return false;
+	int major = 0, minor = 0;
+	if (sscanf(name.release, "%d.%d", &major, &minor) != 2)
+		return false;
+	return major > 6 || (major == 6 && minor >= 0);
+}
+
+UringLoop::UringLoop(Server &server, int listen_fd)
+    : server(server), listen_fd(listen_fd), ring_fd(-1), sq_ring(MAP_FAILED),
+      sq_ring_size(0), cq_ring(MAP_FAILED), cq_ring_size(0), sqes(MAP_FAILED),
+      sqes_size(0), local_sq_tail(0), to_submit(0), buffer_ring(MAP_FAILED),
+      buffer_ring_size(0), buffers(NULL), buffer_ring_tail(0), accepting(false),
+      accept_serial(0), timeout_armed(false), next_serial(1) {
+	timeout.tv_sec = 0;
+	timeout.tv_nsec = 100 * 1000000;
+}
+
+UringLoop *UringLoop::create(Server &server, int listen_fd) {
+	if (!kernel_is_recent_enough())
+		return NULL;
+	UringLoop *loop = new UringLoop(server, listen_fd);
+	if (!loop->setup()) {
+		delete loop;
+		return NULL;
+	}
+	return loop;
+}
+
+bool UringLoop::setup() {
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+	params.cq_entries = URING_CQ_ENTRIES;
+	ring_fd = io_uring_setup(URING_ENTRIES, &params);
+	if (ring_fd < 0)
+		return false;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(params.features & IORING_FEAT_FAST_POLL) ||
+	    !(params.features & IORING_FEAT_NODROP))
+		return false;
+
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (cq_ring_size > sq_ring_size)
+		sq_ring_size = cq_ring_size;
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+		return false;
+	cq_ring = sq_ring; // IORING_FEAT_SINGLE_MMAP
+	cq_ring_size = 0;
+	sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return false;
+
+	char *sq = static_cast<char *>(sq_ring);
+	sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+	sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+	sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+	sq_entries = params.sq_entries;
+	sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+	local_sq_tail = *sq_tail;
+	char *cq = static_cast<char *>(cq_ring);
+	cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+	cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+	cqes = cq + params.cq_off.cqes;
+
+	// Provided buffers: the ring of descriptors plus the buffers it points to.
+	buffer_ring_size = RECV_BUFFER_COUNT * sizeof(io_uring_buf);
+	buffer_ring = mmap(NULL, buffer_ring_size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer_ring == MAP_FAILED)
+		return false;
+	// Fault the ring in before registering it, or the kernel may pin the
+	// shared zero page and never see our tail updates.
+	memset(buffer_ring, 0, buffer_ring_size);
+	buffers = static_cast<char *>(mmap(NULL, RECV_BUFFER_COUNT * RECV_BUFFER_SIZE,
+					   PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (buffers == MAP_FAILED) {
+		buffers = NULL;
+		return false;
+	}
+	io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uintptr_t>(buffer_ring);
+	reg.ring_entries = RECV_BUFFER_COUNT;
+	reg.bgid = RECV_BUFFER_GROUP;
+	if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return false;
+	for (unsigned i = 0; i < RECV_BUFFER_COUNT; i++)
+		recycle_buffer(i);
+	return true;
+}
+
+UringLoop::~UringLoop() {
+	if (buffers != NULL)
+		munmap(buffers, RECV_BUFFER_COUNT * RECV_BUFFER_SIZE);
+	if (buffer_ring != MAP_FAILED)
+		munmap(buffer_ring, buffer_ring_size);
+	if (sqes != MAP_FAILED)
+		munmap(sqes, sqes_size);
+	if (sq_ring != MAP_FAILED)
+		munmap(sq_ring, sq_ring_size);
+	if (ring_fd >= 0)
+		close(ring_fd);
+}
+
+// io_uring_buf_ring is not used directly: in C++ the empty struct inside
+// __DECLARE_FLEX_ARRAY takes a byte and shifts bufs[] by 8. The ring is an
+// array of io_uring_buf whose first resv field doubles as the tail.
+void UringLoop::recycle_buffer(unsigned id) {
+	io_uring_buf *ring = static_cast<io_uring_buf *>(buffer_ring);
+	io_uring_buf &buf = ring[buffer_ring_tail & (RECV_BUFFER_COUNT - 1)];
+	buf.addr = reinterpret_cast<uintptr_t>(buffers + (size_t)id * RECV_BUFFER_SIZE);
+	buf.len = RECV_BUFFER_SIZE;
+	buf.bid = (uint16_t)id;
+	buffer_ring_tail++;
+	__atomic_store_n(&ring[0].resv, buffer_ring_tail, __ATOMIC_RELEASE);
+}
+
+void *UringLoop::get_sqe() {
+	if (local_sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+		submit(false);
+	unsigned index = local_sq_tail & sq_mask;
+	io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes) + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[index] = index;
+	local_sq_tail++;
+	to_submit++;
+	return sqe;
+}
+
+void UringLoop::submit(bool wait) {
+	__atomic_store_n(sq_tail, local_sq_tail, __ATOMIC_RELEASE);
+	unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	while (to_submit != 0 || wait) {
+		int submitted = io_uring_enter(ring_fd, to_submit, wait ? 1 : 0, flags);
+		if (submitted < 0) {
+			if (errno == EINTR && Server::signaled)
+				return;
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			throw std::runtime_error("Error while submitting to io_uring!");
+		}
+		to_submit -= submitted;
+		wait = false;
+		flags = 0;
+	}
+}
+
+void UringLoop::arm_accept() {
+	io_uring_sqe *sqe = static_cast<io_uring_sqe *>(get_sqe());
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listen_fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = make_user_data(op_accept, listen_fd, accept_serial);
+}
+
+void UringLoop::update_accepting() {
+	bool wanted = server.overload.accepting();
+	if (wanted == accepting)
+		return;
+	accepting = wanted;
+	if (accepting) {
+		accept_serial++;
+		arm_accept();
+	} else {
+		cancel(make_user_data(op_accept, listen_fd, accept_serial));
+	}
+}
+
+void UringLoop::arm_timeout() {
+	io_uring_sqe *sqe = static_cast<io_uring_sqe *>(get_sqe());
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = reinterpret_cast<uintptr_t>(&timeout);
+	sqe->len = 1;
+	sqe->user_data = make_user_data(op_timeout, 0, 0);
+	timeout_armed = true;
+}
+
+void UringLoop::arm_recv(int fd) {
+	io_uring_sqe *sqe = static_cast<io_uring_sqe *>(get_sqe());
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	if (server.overload.get_stage() >= Overload::limit_reads) {
+		sqe->len = LIMITED_READ_SIZE;
+		multishot.erase(fd);
+		server.overload.count_limited_read();
+	} else {
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		multishot.insert(fd);
+	}
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RECV_BUFFER_GROUP;
+	sqe->user_data = make_user_data(op_recv, fd, serials[fd]);
+}
+
+// Re-arms a finished recv, unless the client's reads are paused.
+void UringLoop::rearm_recv(int fd) {
+	if (server.reads_paused(server.clients[fd]))
+		paused.insert(fd);
+	else
+		arm_recv(fd);
+}
+
+void UringLoop::resume_reads() {
+	std::set<int>::iterator it = paused.begin();
+	while (it != paused.end()) {
+		if (server.reads_paused(server.clients[*it])) {
+			++it;
+		} else {
+			arm_recv(*it);
+			paused.erase(it++);
+		}
+	}
+}
+
+void UringLoop::submit_send(uint64_t key) {
+	send_buffer &buffer = sends[key];
+	io_uring_sqe *sqe = static_cast<io_uring_sqe *>(get_sqe());
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = user_data_fd(key);
+	sqe->addr = reinterpret_cast<uintptr_t>(buffer.data.data() + buffer.offset);
+	sqe->len = buffer.data.size() - buffer.offset;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = key;
+}
+
+// One send in flight per client. The queued output is moved into a buffer
+// owned by the loop, so it stays valid even if the client goes away before
+// the send completes; output queued meanwhile goes out with the next send.
+void UringLoop::start_send(int fd) {
+	std::map<int, uint32_t>::iterator serial = serials.find(fd);
+	std::map<int, Client *>::iterator client = server.clients.find(fd);
+	if (serial == serials.end() || client == server.clients.end()
+	    || (client->second->output.empty() && client->second->compressed.empty()))
+		return;
+	uint64_t key = make_user_data(op_send, fd, serial->second);
+	if (sends.count(key) != 0)
+		return;
+	send_buffer &buffer = sends[key];
+	server.compress_output(client->second);
+	buffer.data.swap(client->second->compressor ? client->second->compressed : client->second->output);
+	buffer.offset = 0;
+	if (client->second->kind == Client::link)
+		server.link_counters.link_writes++;
+	submit_send(key);
+}
+
+void UringLoop::cancel(uint64_t user_data) {
+	io_uring_sqe *sqe = static_cast<io_uring_sqe *>(get_sqe());
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = user_data;
+	sqe->user_data = make_user_data(op_cancel, 0, 0);
+}
+
+void UringLoop::watch(int fd) {
+	serials[fd] = next_serial++;
+	arm_recv(fd);
+}
+
+void UringLoop::forget(int fd) {
+	std::map<int, uint32_t>::iterator serial = serials.find(fd);
+	if (serial == serials.end())
+		return;
+	cancel(make_user_data(op_recv, fd, serial->second));
+	uint64_t send_key = make_user_data(op_send, fd, serial->second);
+	std::map<uint64_t, send_buffer>::iterator send = sends.find(send_key);
+	if (send != sends.end()) {
+		cancel(send_key);
+		// The data stays until the kernel lets go of it, but it no longer
+		// counts as queued output.
+		server.output_bytes -= send->second.data.size() - send->second.offset;
+		send->second.offset = send->second.data.size();
+	}
+	serials.erase(serial);
+	multishot.erase(fd);
+	paused.erase(fd);
+	// The fd is closed right after this; the cancels must reach the kernel
+	// before a new connection can be handed the same number.
+	submit(false);
+}
+
+size_t UringLoop::in_flight(int fd) const {
+	std::map<int, uint32_t>::const_iterator serial = serials.find(fd);
+	if (serial == serials.end())
+		return 0;
+	std::map<uint64_t, send_buffer>::const_iterator send =
+	    sends.find(make_user_data(op_send, fd, serial->second));
+	if (send == sends.end())
+		return 0;
+	return send->second.data.size() - send->second.offset;
+}
+
+void UringLoop::handle_completion(uint64_t user_data, int32_t res, uint32_t flags) {
+	int fd = user_data_fd(user_data);
+	std::map<int, uint32_t>::iterator serial = serials.find(fd);
+	bool current = serial != serials.end() && serial->second == user_data_serial(user_data);
+	// Clients closed earlier in the batch are torn down after it.
+	if (current && server.clients[fd]->closing)
+		current = false;
+
+	switch (user_data_operation(user_data)) {
+	case op_accept:
+		if (res >= 0) {
+			server.overload.accepted();
+			sockaddr_storage addr;
+			socklen_t size = sizeof(addr);
+			if (getpeername(res, reinterpret_cast<sockaddr *>(&addr), &size) < 0) {
+				close(res);
+			} else if (server.accept_client(res, reinterpret_cast<sockaddr *>(&addr), size)) {
+				watch(res);
+			}
+		} else if ((res == -EMFILE || res == -ENFILE) && server.overload.out_of_descriptors()) {
+			std::cout << "Out of file descriptors, pausing accepts." << std::endl;
+		}
+		if (!(flags & IORING_CQE_F_MORE) && accepting && server.overload.accepting() &&
+		    user_data_serial(user_data) == accept_serial)
+			arm_accept();
+		break;
+	case op_recv:
+		if (res > 0) {
+			unsigned id = flags >> IORING_CQE_BUFFER_SHIFT;
+			if (current)
+				current = server.receive(server.clients[fd], buffers + (size_t)id * RECV_BUFFER_SIZE, res);
+			recycle_buffer(id);
+			if (current && !(flags & IORING_CQE_F_MORE)) {
+				rearm_recv(fd);
+			} else if (current && multishot.count(fd) &&
+				   server.overload.get_stage() >= Overload::limit_reads) {
+				// Ends with -ECANCELED, which re-arms it as a single recv.
+				cancel(user_data);
+				multishot.erase(fd);
+			}
+		} else if (current) {
+			if (res == -ENOBUFS || res == -ECANCELED)
+				rearm_recv(fd);
+			else
+				server.close_client(server.clients[fd]);
+		}
+		break;
+	case op_send: {
+		std::map<uint64_t, send_buffer>::iterator send = sends.find(user_data);
+		if (send == sends.end())
+			break;
+		if (!current || res < 0) {
+			server.output_bytes -= send->second.data.size() - send->second.offset;
+			sends.erase(send);
+			if (current)
+				server.close_client(server.clients[fd]);
+			break;
+		}
+		send->second.offset += res;
+		server.output_bytes -= res;
+		server.charge(server.clients[fd], Client::memory_output, -res);
+		if (send->second.offset < send->second.data.size()) {
+			submit_send(user_data);
+		} else {
+			sends.erase(send);
+			start_send(fd);
+		}
+		break;
+	}
+	case op_cancel:
+		break;
+	case op_timeout:
+		timeout_armed = false;
+		break;
+	}
+}
+
+void UringLoop::flush_output() {
+	std::vector<int> ready;
+	ready.swap(server.output_ready);
+	for (size_t i = 0; i < ready.size(); i++)
+		start_send(ready[i]);
+}
+
+void UringLoop::run() {
+	std::cout << "Using io_uring.\n";
+	while (server.running && !Server::signaled) {
+		update_accepting();
+		resume_reads();
+		if (server.overload.get_stage() != Overload::normal && !timeout_armed)
+			arm_timeout();
+		flush_output();
+		// Only wait when the last iteration left no completions behind
+		// and no task that can go on.
+		submit(*cq_head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) && !server.tasks_runnable());
+		uint64_t start = monotonic_nanoseconds();
+
+		// Completions are taken in batches, like poll() hands out at most
+		// one event per descriptor, so the overload stage and the sends
+		// keep up with what the reads produce.
+		unsigned head = *cq_head;
+		unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		for (unsigned handled = 0; head != tail && handled < URING_BATCH; handled++) {
+			io_uring_cqe *cqe = static_cast<io_uring_cqe *>(cqes) + (head & cq_mask);
+			uint64_t user_data = cqe->user_data;
+			int32_t res = cqe->res;
+			uint32_t flags = cqe->flags;
+			head++;
+			__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+			handle_completion(user_data, res, flags);
+			if (head == tail)
+				tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		}
+		server.end_iteration(monotonic_nanoseconds() - start);
+	}
+}
+
+#else
+
+UringLoop *UringLoop::create(Server &server, int listen_fd) {
+	(void)server;
+	(void)listen_fd;
+	return NULL;
+}
+
+UringLoop::~UringLoop() {
+}
+
+void UringLoop::watch(int fd) {
+	(void)fd;
+}
+
+void UringLoop::forget(int fd) {
+	(void)fd;
+}
+
+size_t UringLoop::in_flight(int fd) const {
+	(void)fd;
+	return 0;
+}
+
+void UringLoop::run() {
+}
+
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+
+class Server;
+
+// io_uring event loop for Server (Linux 6.0 and later). The listening socket
+// has one multishot accept armed, every client one multishot recv that picks
+// its buffer from a ring of provided buffers, and every client with queued
+// output one send in flight. Completions are handed to the same Server
+// methods the poll loop uses, so Client/Channel logic is shared; one
+// io_uring_enter per loop iteration submits everything queued and waits for
+// the next completions.
+//
+// create() returns NULL when the kernel lacks io_uring or one of the
+// features above, and the Server falls back to poll.
+class UringLoop {
+	private:
+		struct send_buffer {
+			std::string data;
+			size_t      offset;
+		};
+
+		Server          &server;
+		int             listen_fd;
+		int             ring_fd;
+
+		// Submission and completion rings, mapped from the kernel.
+		void            *sq_ring;
+		size_t          sq_ring_size;
+		void            *cq_ring;
+		size_t          cq_ring_size;
+		void            *sqes;
+		size_t          sqes_size;
+		unsigned        *sq_head;
+		unsigned        *sq_tail;
+		unsigned        sq_mask;
+		unsigned        sq_entries;
+		unsigned        *sq_array;
+		unsigned        *cq_head;
+		unsigned        *cq_tail;
+		unsigned        cq_mask;
+		void            *cqes;
+		unsigned        local_sq_tail;
+		unsigned        to_submit;
+
+		// Provided buffer ring for recv.
+		void            *buffer_ring;
+		size_t          buffer_ring_size;
+		char            *buffers;
+		uint16_t        buffer_ring_tail;
+
+		// Connections are numbered so completions for a closed fd are
+		// not mistaken for a later connection that reuses it.
+		// Accepts are cancelled while the server sheds load. A cancelled
+		// accept is told apart from the current one by its serial.
+		bool                    accepting;
+		uint32_t                accept_serial;
+		// A timeout keeps the loop turning while overloaded and idle.
+		bool                    timeout_armed;
+		struct { // Laid out like __kernel_timespec.
+			int64_t tv_sec;
+			long long tv_nsec;
+		}                       timeout;
+
+		uint32_t                next_serial;
+		std::map<int, uint32_t> serials;
+		// Clients whose recv is multishot. While the server limits reads,
+		// each client gets single recvs of LIMITED_READ_SIZE instead.
+		std::set<int>           multishot;
+		// Clients not read while their output drains (Server::reads_paused).
+		std::set<int>           paused;
+		std::map<uint64_t, send_buffer> sends;
+
+		UringLoop(Server &server, int listen_fd);
+		UringLoop(const UringLoop &src);
+		bool    setup();
+		void    *get_sqe();
+		void    submit(bool wait);
+		void    arm_accept();
+		void    arm_timeout();
+		void    update_accepting();
+		void    arm_recv(int fd);
+		void    rearm_recv(int fd);
+		void    resume_reads();
+		void    start_send(int fd);
+		void    submit_send(uint64_t key);
+		void    cancel(uint64_t user_data);
+		void    recycle_buffer(unsigned id);
+		void    handle_completion(uint64_t user_data, int32_t res, uint32_t flags);
+		void    flush_output();
+
+	public:
+		static UringLoop *create(Server &server, int listen_fd);
+		~UringLoop();
+		// Starts reading fd, a connection the Server opened itself or
+		// one that was just accepted.
+		void    watch(int fd);
+		// Server is about to close fd: cancel what is in flight for it.
+		void    forget(int fd);
+		// Bytes of fd's output handed to the kernel but not sent yet.
+		size_t  in_flight(int fd) const;
+		// Runs until Server::signaled is set.
+		void    run();
+};
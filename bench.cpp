@@ -0,0 +1,552 @@
+#include "ChannelLog.hpp"
+#include "Compressor.hpp"
+#include "MaskSet.hpp"
+#include "Parser.hpp"
+#include "Server.hpp"
+#include "Text.hpp"
+#include "Tls.hpp"
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Micro-benchmarks. `./bench` runs all of them, `./bench <name>` only one.
+
+static double now() {
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, double count, const char *unit,
+		   double seconds) {
+	printf("%-24s %12.0f %s/s\n", name, count / seconds, unit);
+}
+
+// Lexes and parses a stream of typical client lines, in chunks the size of
+// one recv.
+static void bench_parse() {
+	const char *lines[] = {
+	    ":alice!a@127.0.0.1 PRIVMSG #channel :Hello everyone! How are you "
+	    "today?\r\n",
+	    "PING :irc.example.net\r\n",
+	    "JOIN #channel\r\n",
+	    "NOTICE bob :a short notice\r\n",
+	    "MODE #channel +o bob\r\n",
+	};
+	std::string chunk;
+	int lines_per_chunk = 0;
+	while (chunk.size() < 900) {
+		chunk += lines[lines_per_chunk % 5];
+		lines_per_chunk++;
+	}
+
+	const int rounds = 20000;
+	lex_state l = make_lex_state();
+	parse_state p = make_parse_state();
+	size_t parsed = 0;
+	double start = now();
+	for (int i = 0; i < rounds; i++) {
+		std::vector<lexeme> lexemes = lex_string(chunk.c_str(), &l);
+		std::vector<parseme> parsemes = parse_lexeme_string(lexemes, &p);
+		parsed += parsemes.size();
+	}
+	double seconds = now() - start;
+	assert(parsed == (size_t)rounds * lines_per_chunk);
+	report("parse", parsed, "lines", seconds);
+}
+
+// The server's own path, parse_buffer() over recv-sized chunks, for plain
+// lines and for the same lines with IRCv3 tags in front.
+static void bench_parse_buffer() {
+	const char *lines[] = {
+	    "PRIVMSG #channel :Hello everyone! How are you today?\r\n",
+	    "PING :irc.example.net\r\n",
+	    "JOIN #channel\r\n",
+	    "NOTICE bob :a short notice\r\n",
+	    "MODE #channel +b nick!*@*\r\n",
+	};
+	const char *tags = "@+draft/reply=abc123;+typing=active;label=x\\sy ";
+	for (int tagged = 0; tagged < 2; tagged++) {
+		std::string chunk;
+		int lines_per_chunk = 0;
+		while (chunk.size() < 900) {
+			if (tagged)
+				chunk += tags;
+			chunk += lines[lines_per_chunk % 5];
+			lines_per_chunk++;
+		}
+		const int rounds = 50000;
+		lex_state l = make_lex_state();
+		parse_state p = make_parse_state();
+		size_t parsed = 0;
+		std::vector<message> messages;
+		double start = now();
+		for (int i = 0; i < rounds; i++) {
+			messages.clear();
+			parse_buffer(chunk.data(), chunk.size(), &l, &p, messages);
+			parsed += messages.size();
+		}
+		double seconds = now() - start;
+		assert(parsed == (size_t)rounds * lines_per_chunk);
+		report(tagged ? "parse buffer tagged" : "parse buffer", parsed, "lines", seconds);
+	}
+}
+
+static std::string numbered(const char *format, unsigned a, unsigned b) {
+	char buffer[128];
+	snprintf(buffer, sizeof(buffer), format, a, b);
+	return buffer;
+}
+
+// Checks sources against ban lists of growing size, once with MaskSet and
+// once trying every mask in turn with MaskSet::match.
+// UTF-8 validation of message text and folding of names, with each kernel
+// the CPU supports: ASCII and mixed trailing parameters of a typical
+// length, and nicknames and channel names as looked up in the name index.
+static void bench_text() {
+	std::string ascii, mixed;
+	while (ascii.size() < 200)
+		ascii += "Hello everyone! How are you today? ";
+	while (mixed.size() < 200)
+		mixed += "Gr\xC3\xBC\xC3\x9F dich, \xE2\x82\xAC \xF0\x9F\x98\x80 ok. ";
+	const char *names[] = {"Alice", "bob[away]", "#Channel", "#ft_irc-Developers-Lounge"};
+	size_t name_count = sizeof(names) / sizeof(*names);
+	text_kernel best = best_text_kernel();
+	for (int k = text_scalar; k <= best; k++) {
+		use_text_kernel(static_cast<text_kernel>(k));
+		const int rounds = 2000000;
+		char name[64];
+		for (int m = 0; m < 2; m++) {
+			const std::string &text = m ? mixed : ascii;
+			size_t valid = 0;
+			double start = now();
+			for (int i = 0; i < rounds; i++)
+				valid += valid_utf8(text.data(), text.size() - i % 2);
+			double seconds = now() - start;
+			assert(valid == (size_t)rounds || m);
+			snprintf(name, sizeof(name), "utf8 %s %s", m ? "mixed" : "ascii", text_kernel_name(static_cast<text_kernel>(k)));
+			report(name, rounds * (double)text.size(), "bytes", seconds);
+		}
+		char folded[64];
+		size_t sum = 0;
+		double start = now();
+		for (int i = 0; i < rounds; i++) {
+			const char *n = names[i % name_count];
+			size_t length = strlen(n);
+			fold_name(n, length, folded);
+			sum += folded[length - 1];
+		}
+		double seconds = now() - start;
+		assert(sum > 0);
+		snprintf(name, sizeof(name), "fold names %s", text_kernel_name(static_cast<text_kernel>(k)));
+		report(name, rounds, "names", seconds);
+	}
+	use_text_kernel(best);
+}
+
+static void bench_masks() {
+	const unsigned sizes[] = {10, 100, 1000, 10000};
+	std::vector<std::string> sources;
+	for (unsigned k = 0; k < 1000; k++) {
+		if (k % 10 == 0) // Banned by a nick!*@* mask.
+			sources.push_back(numbered("NICK%u!someone@host%u.client.org", k * 4 + 1, k));
+		else
+			sources.push_back(numbered("user%u!ident%u@client.example.org", k, k));
+	}
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+		unsigned size = sizes[s];
+		MaskSet set;
+		std::vector<std::string> masks;
+		for (unsigned i = 0; i < size; i++) {
+			switch (i % 4) {
+			case 0: masks.push_back(numbered("*!*@host%u.example.net", i, 0)); break;
+			case 1: masks.push_back(numbered("nick%u!*@*", i, 0)); break;
+			case 2: masks.push_back(numbered("*!ident%u@*.isp%u.net", i, i % 97)); break;
+			case 3: masks.push_back(numbered("*!*@10.%u.%u.*", i % 256, i / 256 % 256)); break;
+			}
+			set.add(masks.back());
+		}
+
+		size_t checks = 0, hits = 0;
+		double start = now();
+		for (int round = 0; round < 100; round++) {
+			for (size_t k = 0; k < sources.size(); k++)
+				hits += set.matches(sources[k]);
+			checks += sources.size();
+		}
+		double seconds = now() - start;
+		char name[64];
+		snprintf(name, sizeof(name), "masks %u compiled", size);
+		report(name, checks, "checks", seconds);
+
+		size_t naive_checks = 0, naive_hits = 0;
+		size_t naive_rounds = size >= 1000 ? 1 : 10;
+		size_t naive_sources = size >= 10000 ? sources.size() / 10 : sources.size();
+		start = now();
+		for (size_t round = 0; round < naive_rounds; round++) {
+			for (size_t k = 0; k < naive_sources; k++) {
+				bool banned = false;
+				for (size_t i = 0; i < masks.size() && !banned; i++)
+					banned = MaskSet::match(masks[i], sources[k]);
+				naive_hits += banned;
+			}
+			naive_checks += naive_sources;
+		}
+		seconds = now() - start;
+		snprintf(name, sizeof(name), "masks %u one by one", size);
+		report(name, naive_checks, "checks", seconds);
+		size_t expected = 0;
+		for (size_t k = 0; k < naive_sources; k++)
+			expected += set.matches(sources[k]);
+		assert(hits > 0 && naive_hits == expected * naive_rounds);
+	}
+}
+
+static void remove_directory(const char *path) {
+	DIR *dir = opendir(path);
+	while (dirent *d = readdir(dir)) {
+		if (d->d_name[0] != '.')
+			unlink((std::string(path) + "/" + d->d_name).c_str());
+	}
+	closedir(dir);
+	rmdir(path);
+}
+
+// Cost of logging one channel message: into ChannelLog, and into an ofstream
+// the way a logger in the event loop would, buffered and flushed per line.
+// Then time range reads of 20 lines from what ChannelLog wrote.
+static void bench_log() {
+	const unsigned messages = 2000000, channels = 100;
+	std::vector<std::string> names, lines;
+	for (unsigned i = 0; i < channels; i++)
+		names.push_back(numbered("#channel%u", i, 0));
+	for (unsigned i = 0; i < 1000; i++)
+		lines.push_back(numbered(":nick%u!user@host.example.org PRIVMSG #channel%u :Hello everyone! "
+					 "How are you today?", i, i % channels));
+
+	char directory[] = "/tmp/ircserv-bench-XXXXXX";
+	if (!mkdtemp(directory))
+		return;
+	uint64_t first, last;
+	double seconds;
+	{
+		ChannelLog log(directory);
+		double start = now();
+		for (unsigned i = 0; i < messages; i++)
+			log.append(names[i % channels], lines[i % 1000]);
+		seconds = now() - start;
+		report("log append", messages, "messages", seconds);
+		printf("%-24s %12.1f ns/message, %lu rotations, %lu stalls\n", "log append",
+		       seconds * 1e9 / messages, log.get_stats().rotations, log.get_stats().stalls);
+
+		std::vector<ChannelLog::entry> all;
+		log.read(names[0], 0, (uint64_t)-1, 1, false, all);
+		log.read(names[0], 0, (uint64_t)-1, 1, true, all);
+		first = all[0].time;
+		last = all[1].time;
+		const unsigned reads = 2000;
+		size_t found = 0;
+		start = now();
+		for (unsigned i = 0; i < reads; i++) {
+			std::vector<ChannelLog::entry> some;
+			uint64_t from = first + (last - first) / reads * i;
+			log.read(names[i % channels], from, (uint64_t)-1, 20, false, some);
+			found += some.size();
+		}
+		seconds = now() - start;
+		assert(found > 0);
+		report("log read 20 lines", reads, "reads", seconds);
+	}
+	remove_directory(directory);
+
+	const char *modes[] = {"ofstream buffered", "ofstream flushed"};
+	for (int mode = 0; mode < 2; mode++) {
+		char plain[] = "/tmp/ircserv-bench-XXXXXX";
+		if (!mkdtemp(plain))
+			return;
+		std::string path = std::string(plain) + "/log";
+		std::ofstream file(path.c_str());
+		unsigned count = mode ? messages / 10 : messages;
+		double start = now();
+		for (unsigned i = 0; i < count; i++) {
+			file << names[i % channels] << ' ' << lines[i % 1000] << '\n';
+			if (mode)
+				file.flush();
+		}
+		seconds = now() - start;
+		file.close();
+		report(modes[mode], count, "messages", seconds);
+		printf("%-24s %12.1f ns/message\n", modes[mode], seconds * 1e9 / count);
+		remove_directory(plain);
+	}
+}
+
+// What compressing a busy client's output costs and saves: batches of
+// channel lines the size one flush would carry, through deflate at a few
+// levels. Flushing after every line shows why compression waits for the
+// whole batch. Short connections show what the dictionary is worth.
+static void bench_compress() {
+	const char *words[] = {"the", "server", "is", "lagging", "again", "who", "wants",
+			       "lunch", "ok", "lol", "merge", "that", "branch", "please", "thanks",
+			       "anyone", "seen", "the", "build", "broke", "https://example.org/x"};
+	std::vector<std::string> lines;
+	uint32_t seed = 1;
+	size_t total = 0;
+	while (total < (8 << 20)) {
+		seed = seed * 1103515245 + 12345;
+		std::string line = numbered(":nick%u!user@host%u.example.org PRIVMSG #channel", seed % 1000, seed % 97);
+		line += numbered("%u :", seed % 100, 0);
+		for (unsigned n = 3 + seed % 9; n > 0; n--) {
+			seed = seed * 1103515245 + 12345;
+			line += words[(seed >> 16) % 21];
+			line += n > 1 ? " " : "\r\n";
+		}
+		lines.push_back(line);
+		total += line.size();
+	}
+
+	struct setup {
+		const char *name;
+		int level;
+		bool primed;
+		unsigned lines_per_batch;
+	};
+	const setup setups[] = {
+	    {"compress 1 line", 3, true, 1},
+	    {"compress 16 lines", 3, true, 16},
+	    {"compress 64 lines", 1, true, 64},
+	    {"compress 64 lines", 3, true, 64},
+	    {"compress 64 lines", 6, true, 64},
+	};
+	for (size_t k = 0; k < sizeof(setups) / sizeof(*setups); k++) {
+		Compressor compressor(setups[k].level, setups[k].primed);
+		std::string batch, out;
+		size_t out_size = 0;
+		double start = now();
+		for (size_t i = 0; i < lines.size(); i++) {
+			batch += lines[i];
+			if ((i + 1) % setups[k].lines_per_batch && i + 1 < lines.size())
+				continue;
+			compressor.compress(batch.data(), batch.size(), out);
+			out_size += out.size();
+			out.clear();
+			batch.clear();
+		}
+		double seconds = now() - start;
+		printf("%-24s level %d %8.1f MB/s %6.1f ns/line %5.1f%% of the bytes\n",
+		       setups[k].name, setups[k].level, total / seconds / 1e6,
+		       seconds * 1e9 / lines.size(), 100.0 * out_size / total);
+	}
+
+	// The first 4 KiB of many connections, with and without the dictionary.
+	for (int primed = 1; primed >= 0; primed--) {
+		const unsigned connections = 500;
+		size_t in_size = 0, out_size = 0;
+		double start = now();
+		for (unsigned c = 0; c < connections; c++) {
+			Compressor compressor(COMPRESS_LEVEL, primed);
+			std::string batch, out;
+			for (size_t i = c * 40; batch.size() < 4096; i++)
+				batch += lines[i % lines.size()];
+			compressor.compress(batch.data(), batch.size(), out);
+			in_size += batch.size();
+			out_size += out.size();
+		}
+		double seconds = now() - start;
+		printf("%-24s %8.1f us/connection %5.1f%% of the bytes\n",
+		       primed ? "compress first 4k" : "compress first 4k bare",
+		       seconds * 1e6 / connections, 100.0 * out_size / in_size);
+	}
+}
+
+// Reads everything from the server side of bench_tls until it closes, then
+// exits with whether the byte count was right.
+static void tls_reader(const sockaddr_in &address, bool tls, size_t expected) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0)
+		_exit(1);
+	static char buffer[1 << 16];
+	size_t total = 0;
+	if (!tls) {
+		ssize_t got;
+		while ((got = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+			total += got;
+		_exit(total != expected);
+	}
+	SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+	SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+	SSL *ssl = SSL_new(context);
+	SSL_set_fd(ssl, fd);
+	if (SSL_connect(ssl) != 1)
+		_exit(1);
+	int got;
+	while ((got = SSL_read(ssl, buffer, sizeof(buffer))) > 0)
+		total += got;
+	_exit(total != expected);
+}
+
+// Loopback throughput of the server's sending side: plaintext send(), TLS
+// records encrypted by OpenSSL, and TLS records encrypted by the kernel,
+// with a forked reader decrypting in user space on the other end.
+static void bench_tls() {
+	const size_t total = 256 << 20, chunk = 64 << 10;
+	std::string data(chunk, 'x');
+	const char *modes[] = {"send plaintext", "send tls user space", "send ktls"};
+	for (int mode = 0; mode < 3; mode++) {
+		int listener = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t size = sizeof(address);
+		if (bind(listener, reinterpret_cast<sockaddr *>(&address), size) < 0
+		    || listen(listener, 1) < 0
+		    || getsockname(listener, reinterpret_cast<sockaddr *>(&address), &size) < 0)
+			return;
+		pid_t reader = fork();
+		if (reader == 0)
+			tls_reader(address, mode > 0, total);
+		int fd = accept(listener, NULL, NULL);
+		close(listener);
+
+		TlsContext *context = mode ? TlsContext::self_signed("bench", mode == 2) : NULL;
+		TlsSession *session = context ? new TlsSession(context->wrap(fd)) : NULL;
+		if (session && session->handshake() != TlsSession::ok) {
+			printf("%-24s handshake failed\n", modes[mode]);
+			return;
+		}
+		bool kernel = !session || session->sends_in_kernel();
+		double start = now();
+		for (size_t sent = 0; sent < total;) {
+			size_t done = 0;
+			if (kernel) {
+				ssize_t result = send(fd, data.data(), chunk, 0);
+				done = result > 0 ? result : 0;
+			} else if (session->write(data.data(), chunk, done) != TlsSession::ok) {
+				break;
+			}
+			sent += done;
+		}
+		close(fd);
+		int status;
+		waitpid(reader, &status, 0);
+		double seconds = now() - start;
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		if (mode == 2 && !kernel)
+			printf("%-24s %12s (the kernel did not take the keys; no tls module?)\n",
+			       modes[mode], "-");
+		else
+			printf("%-24s %8.0f MB/s %s\n", modes[mode], total / seconds / 1e6,
+			       session ? session->cipher() : "");
+		delete session;
+		delete context;
+	}
+}
+
+// Lets the server send what it queued and reads it all from the other end
+// of the socketpair; returns whether `end` came by.
+static bool pump(Server &server, int peer, const char *end, std::string &tail) {
+	server.poll_once(0);
+	char buffer[65536];
+	bool seen = false;
+	ssize_t n;
+	while ((n = recv(peer, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+		tail.append(buffer, n);
+		seen = seen || tail.find(end) != std::string::npos;
+		tail.erase(0, tail.size() > 64 ? tail.size() - 64 : 0);
+	}
+	return seen;
+}
+
+static Client *bench_client(Server &server, const char *nick, int &peer) {
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+		return NULL;
+	peer = pair[1];
+	Client *client = server.add_client(pair[0], 0, "bench.example.org");
+	std::string registration = std::string("PASS bench\r\nNICK ") + nick + "\r\nUSER bench 0 * :bench\r\n";
+	server.receive(client, registration.data(), registration.size());
+	return client;
+}
+
+// Time from LIST to the end of its reply with 50k channels, through the
+// server's task steps, its send path and a socketpair: first while every
+// channel's entry has to be built, then from the cached entries, then after
+// a JOIN to every tenth channel emptied those entries again.
+static void bench_list() {
+	const unsigned channels = 50000;
+	std::cout.setstate(std::ios::failbit); // Connect/disconnect chatter.
+	{
+		Server server("0", "bench");
+		server.set_memory_limits((size_t)-1, (size_t)-1);
+		int maker_peer, lister_peer;
+		Client *maker = bench_client(server, "maker", maker_peer);
+		Client *lister = bench_client(server, "lister", lister_peer);
+		std::string tail;
+		for (unsigned i = 0; i < channels; i += 100) {
+			std::string join = "JOIN #channel" + numbered("%u", i, 0);
+			for (unsigned j = i + 1; j < i + 100; j++)
+				join += numbered(",#channel%u", j, 0);
+			join += "\r\n";
+			server.receive(maker, join.data(), join.size());
+			pump(server, maker_peer, "\n", tail);
+		}
+		const char *runs[] = {"list 50k channels cold", "list 50k channels cached", "list after 5k joins"};
+		for (int run = 0; run < 3; run++) {
+			if (run == 2) {
+				for (unsigned i = 0; i < channels; i += 10) {
+					std::string join = numbered("JOIN #channel%u\r\n", i, 0);
+					server.receive(lister, join.data(), join.size());
+				}
+				while (!pump(server, lister_peer, numbered("#channel%u :", channels - 10, 0).c_str(), tail))
+					;
+			}
+			const reply_cache_stats before = server.get_reply_cache_stats();
+			tail.clear();
+			double start = now();
+			server.receive(lister, "LIST\r\n", 6);
+			while (!pump(server, lister_peer, " 323 ", tail))
+				;
+			double seconds = now() - start;
+			const reply_cache_stats &after = server.get_reply_cache_stats();
+			printf("%-24s %8.2f ms %6.0f ns/channel, %lu hits, %lu misses\n", runs[run], seconds * 1e3,
+			       seconds * 1e9 / channels, after.list_hits - before.list_hits,
+			       after.list_misses - before.list_misses);
+		}
+		close(maker_peer);
+		close(lister_peer);
+	}
+	std::cout.clear();
+}
+
+struct benchmark {
+	const char *name;
+	void (*run)();
+};
+
+static const benchmark benchmarks[] = {
+    {"parse", bench_parse},
+    {"parse", bench_parse_buffer},
+    {"text", bench_text},
+    {"masks", bench_masks},
+    {"log", bench_log},
+    {"compress", bench_compress},
+    {"tls", bench_tls},
+    {"list", bench_list},
+};
+
+int main(int argc, char **argv) {
+	for (size_t i = 0; i < sizeof(benchmarks) / sizeof(*benchmarks); i++) {
+		if (argc > 1 && strcmp(argv[1], benchmarks[i].name) != 0)
+			continue;
+		benchmarks[i].run();
+	}
+	return 0;
+}
@@ -0,0 +1,4 @@
+objects/$(std)/debug/Capture.o objects/$(std)/optimized/Capture.o objects/$(std)/release/Capture.o: \
+ Capture.cpp Capture.hpp Clock.hpp
+Capture.hpp:
+Clock.hpp:
@@ -0,0 +1,7 @@
+objects/$(std)/debug/Channel.o objects/$(std)/optimized/Channel.o objects/$(std)/release/Channel.o: \
+ Channel.cpp Channel.hpp Client.hpp Parser.hpp MaskSet.hpp Text.hpp
+Channel.hpp:
+Client.hpp:
+Parser.hpp:
+MaskSet.hpp:
+Text.hpp:
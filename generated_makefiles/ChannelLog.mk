@@ -0,0 +1,4 @@
+objects/$(std)/debug/ChannelLog.o objects/$(std)/optimized/ChannelLog.o objects/$(std)/release/ChannelLog.o: \
+ ChannelLog.cpp ChannelLog.hpp Clock.hpp
+ChannelLog.hpp:
+Clock.hpp:
@@ -0,0 +1,3 @@
+objects/$(std)/debug/CidrTrie.o objects/$(std)/optimized/CidrTrie.o objects/$(std)/release/CidrTrie.o: \
+ CidrTrie.cpp CidrTrie.hpp
+CidrTrie.hpp:
@@ -1,3 +1,6 @@
-Client.o: Client.cpp Client.hpp
-
+objects/$(std)/debug/Client.o objects/$(std)/optimized/Client.o objects/$(std)/release/Client.o: \
+ Client.cpp Client.hpp Parser.hpp Compressor.hpp Tls.hpp
 Client.hpp:
+Parser.hpp:
+Compressor.hpp:
+Tls.hpp:
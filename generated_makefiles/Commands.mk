@@ -0,0 +1,19 @@
+objects/$(std)/debug/Commands.o objects/$(std)/optimized/Commands.o objects/$(std)/release/Commands.o: \
+ Commands.cpp Server.hpp Client.hpp Parser.hpp Channel.hpp MaskSet.hpp \
+ Capture.hpp ChannelLog.hpp CidrTrie.hpp History.hpp Overload.hpp Tls.hpp \
+ UringLoop.hpp Compressor.hpp IRCResponse.hpp Text.hpp
+Server.hpp:
+Client.hpp:
+Parser.hpp:
+Channel.hpp:
+MaskSet.hpp:
+Capture.hpp:
+ChannelLog.hpp:
+CidrTrie.hpp:
+History.hpp:
+Overload.hpp:
+Tls.hpp:
+UringLoop.hpp:
+Compressor.hpp:
+IRCResponse.hpp:
+Text.hpp:
@@ -0,0 +1,3 @@
+objects/$(std)/debug/Compressor.o objects/$(std)/optimized/Compressor.o objects/$(std)/release/Compressor.o: \
+ Compressor.cpp Compressor.hpp
+Compressor.hpp:
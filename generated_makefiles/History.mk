@@ -0,0 +1,3 @@
+objects/$(std)/debug/History.o objects/$(std)/optimized/History.o objects/$(std)/release/History.o: \
+ History.cpp History.hpp
+History.hpp:
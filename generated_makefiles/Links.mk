@@ -0,0 +1,18 @@
+objects/$(std)/debug/Links.o objects/$(std)/optimized/Links.o objects/$(std)/release/Links.o: \
+ Links.cpp Server.hpp Client.hpp Parser.hpp Channel.hpp MaskSet.hpp \
+ Capture.hpp ChannelLog.hpp CidrTrie.hpp History.hpp Overload.hpp Tls.hpp \
+ UringLoop.hpp IRCResponse.hpp Text.hpp
+Server.hpp:
+Client.hpp:
+Parser.hpp:
+Channel.hpp:
+MaskSet.hpp:
+Capture.hpp:
+ChannelLog.hpp:
+CidrTrie.hpp:
+History.hpp:
+Overload.hpp:
+Tls.hpp:
+UringLoop.hpp:
+IRCResponse.hpp:
+Text.hpp:
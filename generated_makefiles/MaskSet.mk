@@ -0,0 +1,4 @@
+objects/$(std)/debug/MaskSet.o objects/$(std)/optimized/MaskSet.o objects/$(std)/release/MaskSet.o: \
+ MaskSet.cpp MaskSet.hpp Text.hpp
+MaskSet.hpp:
+Text.hpp:
@@ -0,0 +1,4 @@
+objects/$(std)/debug/Overload.o objects/$(std)/optimized/Overload.o objects/$(std)/release/Overload.o: \
+ Overload.cpp Overload.hpp Clock.hpp
+Overload.hpp:
+Clock.hpp:
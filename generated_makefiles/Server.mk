@@ -1,9 +1,20 @@
-Server.o: Server.cpp Server.hpp Client.hpp Channel.hpp Parser.hpp
-
+objects/$(std)/debug/Server.o objects/$(std)/optimized/Server.o objects/$(std)/release/Server.o: \
+ Server.cpp Server.hpp Client.hpp Parser.hpp Channel.hpp MaskSet.hpp \
+ Capture.hpp ChannelLog.hpp CidrTrie.hpp History.hpp Overload.hpp Tls.hpp \
+ UringLoop.hpp Clock.hpp Compressor.hpp IRCResponse.hpp Text.hpp
 Server.hpp:
-
 Client.hpp:
-
-Channel.hpp:
-
 Parser.hpp:
+Channel.hpp:
+MaskSet.hpp:
+Capture.hpp:
+ChannelLog.hpp:
+CidrTrie.hpp:
+History.hpp:
+Overload.hpp:
+Tls.hpp:
+UringLoop.hpp:
+Clock.hpp:
+Compressor.hpp:
+IRCResponse.hpp:
+Text.hpp:
@@ -0,0 +1,19 @@
+objects/$(std)/debug/Tasks.o objects/$(std)/optimized/Tasks.o objects/$(std)/release/Tasks.o: \
+ Tasks.cpp Server.hpp Client.hpp Parser.hpp Channel.hpp MaskSet.hpp \
+ Capture.hpp ChannelLog.hpp CidrTrie.hpp History.hpp Overload.hpp Tls.hpp \
+ UringLoop.hpp Clock.hpp IRCResponse.hpp Text.hpp
+Server.hpp:
+Client.hpp:
+Parser.hpp:
+Channel.hpp:
+MaskSet.hpp:
+Capture.hpp:
+ChannelLog.hpp:
+CidrTrie.hpp:
+History.hpp:
+Overload.hpp:
+Tls.hpp:
+UringLoop.hpp:
+Clock.hpp:
+IRCResponse.hpp:
+Text.hpp:
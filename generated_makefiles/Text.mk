@@ -0,0 +1,3 @@
+objects/$(std)/debug/Text.o objects/$(std)/optimized/Text.o objects/$(std)/release/Text.o: \
+ Text.cpp Text.hpp
+Text.hpp:
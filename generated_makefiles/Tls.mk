@@ -0,0 +1,3 @@
+objects/$(std)/debug/Tls.o objects/$(std)/optimized/Tls.o objects/$(std)/release/Tls.o: \
+ Tls.cpp Tls.hpp
+Tls.hpp:
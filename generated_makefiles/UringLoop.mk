@@ -0,0 +1,17 @@
+objects/$(std)/debug/UringLoop.o objects/$(std)/optimized/UringLoop.o objects/$(std)/release/UringLoop.o: \
+ UringLoop.cpp UringLoop.hpp Clock.hpp Server.hpp Client.hpp Parser.hpp \
+ Channel.hpp MaskSet.hpp Capture.hpp ChannelLog.hpp CidrTrie.hpp \
+ History.hpp Overload.hpp Tls.hpp
+UringLoop.hpp:
+Clock.hpp:
+Server.hpp:
+Client.hpp:
+Parser.hpp:
+Channel.hpp:
+MaskSet.hpp:
+Capture.hpp:
+ChannelLog.hpp:
+CidrTrie.hpp:
+History.hpp:
+Overload.hpp:
+Tls.hpp:
@@ -1 +1,2 @@
-after_parsing_stub.o: after_parsing_stub.cpp
+objects/$(std)/debug/after_parsing_stub.o objects/$(std)/optimized/after_parsing_stub.o objects/$(std)/release/after_parsing_stub.o: \
+ after_parsing_stub.cpp
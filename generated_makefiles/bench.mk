@@ -0,0 +1,18 @@
+objects/$(std)/debug/bench.o objects/$(std)/optimized/bench.o objects/$(std)/release/bench.o: \
+ bench.cpp ChannelLog.hpp Compressor.hpp MaskSet.hpp Parser.hpp \
+ Server.hpp Client.hpp Channel.hpp Capture.hpp CidrTrie.hpp History.hpp \
+ Overload.hpp Tls.hpp UringLoop.hpp Text.hpp
+ChannelLog.hpp:
+Compressor.hpp:
+MaskSet.hpp:
+Parser.hpp:
+Server.hpp:
+Client.hpp:
+Channel.hpp:
+Capture.hpp:
+CidrTrie.hpp:
+History.hpp:
+Overload.hpp:
+Tls.hpp:
+UringLoop.hpp:
+Text.hpp:
@@ -1 +1,2 @@
-dispatch.o: dispatch.cpp
+objects/$(std)/debug/dispatch.o objects/$(std)/optimized/dispatch.o objects/$(std)/release/dispatch.o: \
+ dispatch.cpp
@@ -0,0 +1,2 @@
+objects/$(std)/debug/load_generator.o objects/$(std)/optimized/load_generator.o objects/$(std)/release/load_generator.o: \
+ load_generator.cpp
@@ -1,3 +1,3 @@
-m.o: m.cpp Parser.hpp
-
+objects/$(std)/debug/m.o objects/$(std)/optimized/m.o objects/$(std)/release/m.o: \
+ m.cpp Parser.hpp
 Parser.hpp:
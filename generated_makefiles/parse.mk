@@ -1,3 +1,3 @@
-parse.o: parse.cpp Parser.hpp
-
+objects/$(std)/debug/parse.o objects/$(std)/optimized/parse.o objects/$(std)/release/parse.o: \
+ parse.cpp Parser.hpp
 Parser.hpp:
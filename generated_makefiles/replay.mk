@@ -0,0 +1,17 @@
+objects/$(std)/debug/replay.o objects/$(std)/optimized/replay.o objects/$(std)/release/replay.o: \
+ replay.cpp Capture.hpp Clock.hpp Server.hpp Client.hpp Parser.hpp \
+ Channel.hpp MaskSet.hpp ChannelLog.hpp CidrTrie.hpp History.hpp \
+ Overload.hpp Tls.hpp UringLoop.hpp
+Capture.hpp:
+Clock.hpp:
+Server.hpp:
+Client.hpp:
+Parser.hpp:
+Channel.hpp:
+MaskSet.hpp:
+ChannelLog.hpp:
+CidrTrie.hpp:
+History.hpp:
+Overload.hpp:
+Tls.hpp:
+UringLoop.hpp:
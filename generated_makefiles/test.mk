@@ -1,5 +1,13 @@
-test.o: test.cpp dispatch.cpp Parser.hpp
-
+objects/$(std)/debug/test.o objects/$(std)/optimized/test.o objects/$(std)/release/test.o: \
+ test.cpp dispatch.cpp ChannelLog.hpp CidrTrie.hpp Compressor.hpp \
+ History.hpp MaskSet.hpp Overload.hpp Parser.hpp Text.hpp Tls.hpp
 dispatch.cpp:
-
+ChannelLog.hpp:
+CidrTrie.hpp:
+Compressor.hpp:
+History.hpp:
+MaskSet.hpp:
+Overload.hpp:
 Parser.hpp:
+Text.hpp:
+Tls.hpp:
@@ -1,9 +1,16 @@
-validation.o: validation.cpp Server.hpp Client.hpp Channel.hpp Parser.hpp
-
+objects/$(std)/debug/validation.o objects/$(std)/optimized/validation.o objects/$(std)/release/validation.o: \
+ validation.cpp Server.hpp Client.hpp Parser.hpp Channel.hpp MaskSet.hpp \
+ Capture.hpp ChannelLog.hpp CidrTrie.hpp History.hpp Overload.hpp Tls.hpp \
+ UringLoop.hpp
 Server.hpp:
-
 Client.hpp:
-
-Channel.hpp:
-
 Parser.hpp:
+Channel.hpp:
+MaskSet.hpp:
+Capture.hpp:
+ChannelLog.hpp:
+CidrTrie.hpp:
+History.hpp:
+Overload.hpp:
+Tls.hpp:
+UringLoop.hpp:
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+// Opens `clients` connections to a running server and replays a recorded
+// traffic file on each of them `rounds` times, as fast as the server reads.
+// Every `$id` in the file is replaced by the connection number so nicks stay
+// unique. A connection is done once the server closes it after our EOF, so
+// the reported time covers the server processing everything that was sent.
+//
+// Meanwhile one more connection, the probe, sends a PING every 10 ms and
+// times the PONGs, which shows how long the server makes a client wait.
+// `stalled` extra connections register, send the file's JOIN lines and
+// never read, so whatever is sent to those channels piles up for them.
+
+struct connection {
+	int fd;
+	std::string output;
+	size_t written;
+	bool done;
+};
+
+static double now() {
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static std::vector<std::string> read_traffic(const char *path) {
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error(std::string("Unable to open ") + path);
+	std::vector<std::string> lines;
+	std::string line;
+	while (std::getline(file, line)) {
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+		lines.push_back(line + "\r\n");
+	}
+	return lines;
+}
+
+static std::string substitute_id(std::string line, int id) {
+	std::ostringstream number;
+	number << id;
+	size_t at;
+	while ((at = line.find("$id")) != std::string::npos)
+		line.replace(at, 3, number.str());
+	return line;
+}
+
+static int open_connection(const char *host, int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw std::runtime_error("Unable to open a socket.");
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+		throw std::runtime_error("Invalid IPv4 address.");
+	if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+		throw std::runtime_error(std::string("Unable to connect: ") +
+					 strerror(errno));
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+struct probe {
+	int fd;
+	bool open;
+	unsigned next;
+	double last;
+	std::map<unsigned, double> sent;
+	std::vector<double> latencies;
+	std::string input;
+};
+
+static void send_ping(probe &p) {
+	char line[64];
+	int size = snprintf(line, sizeof(line), "PING :%u\r\n", p.next);
+	if (send(p.fd, line, size, 0) == size)
+		p.sent[p.next] = now();
+	p.next++;
+	p.last = now();
+}
+
+static void read_pongs(probe &p) {
+	char buffer[4096];
+	ssize_t n;
+	while ((n = recv(p.fd, buffer, sizeof(buffer), 0)) > 0)
+		p.input.append(buffer, n);
+	if (n == 0 || (n < 0 && errno != EAGAIN)) {
+		close(p.fd);
+		p.open = false;
+	}
+	size_t end;
+	while ((end = p.input.find("\r\n")) != std::string::npos) {
+		std::string line = p.input.substr(0, end);
+		p.input.erase(0, end + 2);
+		size_t token = line.find(" PONG :");
+		if (token == std::string::npos)
+			continue;
+		std::map<unsigned, double>::iterator it =
+		    p.sent.find(strtoul(line.c_str() + token + 7, NULL, 10));
+		if (it != p.sent.end()) {
+			p.latencies.push_back(now() - it->second);
+			p.sent.erase(it);
+		}
+	}
+}
+
+static double percentile(std::vector<double> &values, double fraction) {
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[(size_t)(fraction * (values.size() - 1))];
+}
+
+int main(int argc, char **argv) {
+	if (argc < 5 || argc > 8) {
+		std::cerr << "Usage: ./load_generator <host> <port> <password> "
+			     "<traffic file> [clients] [rounds] [stalled]"
+			  << std::endl;
+		return 1;
+	}
+	int clients = argc > 5 ? atoi(argv[5]) : 10;
+	int rounds = argc > 6 ? atoi(argv[6]) : 100;
+	int stalled = argc > 7 ? atoi(argv[7]) : 0;
+
+	signal(SIGPIPE, SIG_IGN);
+	try {
+		std::vector<std::string> traffic = read_traffic(argv[4]);
+		std::vector<connection> connections(clients);
+		size_t lines = 0, bytes = 0;
+		for (int i = 0; i < clients; i++) {
+			connection &c = connections[i];
+			c.fd = open_connection(argv[1], atoi(argv[2]));
+			c.written = 0;
+			c.done = false;
+			c.output = std::string("PASS ") + argv[3] + "\r\n" +
+				   substitute_id("NICK load$id\r\n", i) +
+				   substitute_id("USER load$id 0 * :load\r\n", i);
+			lines += 3;
+			for (int round = 0; round < rounds; round++) {
+				for (size_t j = 0; j < traffic.size(); j++)
+					c.output += substitute_id(traffic[j], i);
+				lines += traffic.size();
+			}
+			bytes += c.output.size();
+		}
+
+		std::vector<int> stalled_fds;
+		for (int i = 0; i < stalled; i++) {
+			int fd = open_connection(argv[1], atoi(argv[2]));
+			std::string output = std::string("PASS ") + argv[3] + "\r\n" +
+					     substitute_id("NICK stall$id\r\n", i) +
+					     substitute_id("USER stall$id 0 * :stalled\r\n", i);
+			for (size_t j = 0; j < traffic.size(); j++) {
+				if (traffic[j].compare(0, 5, "JOIN ") == 0)
+					output += substitute_id(traffic[j], clients + i);
+			}
+			send(fd, output.data(), output.size(), 0);
+			stalled_fds.push_back(fd);
+		}
+
+		probe p;
+		p.fd = open_connection(argv[1], atoi(argv[2]));
+		p.open = true;
+		p.next = 0;
+		std::string hello = std::string("PASS ") + argv[3] + "\r\nNICK probe\r\nUSER probe 0 * :probe\r\n";
+		send(p.fd, hello.data(), hello.size(), 0);
+
+		double start = now();
+		int remaining = clients;
+		std::vector<pollfd> fds(clients + 1);
+		char buffer[4096];
+		send_ping(p);
+		while (remaining > 0) {
+			for (int i = 0; i < clients; i++) {
+				connection &c = connections[i];
+				fds[i].fd = c.done ? -1 : c.fd;
+				fds[i].events = POLLIN;
+				if (c.written < c.output.size())
+					fds[i].events |= POLLOUT;
+				fds[i].revents = 0;
+			}
+			fds[clients].fd = p.open ? p.fd : -1;
+			fds[clients].events = POLLIN;
+			fds[clients].revents = 0;
+			if (poll(&fds[0], fds.size(), 10) < 0)
+				throw std::runtime_error("Error while polling.");
+			if (p.open && fds[clients].revents)
+				read_pongs(p);
+			if (p.open && now() - p.last >= 0.01)
+				send_ping(p);
+			for (int i = 0; i < clients; i++) {
+				connection &c = connections[i];
+				if (fds[i].revents & POLLOUT) {
+					ssize_t n = send(c.fd, c.output.data() + c.written,
+							 c.output.size() - c.written, 0);
+					if (n > 0)
+						c.written += n;
+					if (c.written == c.output.size())
+						shutdown(c.fd, SHUT_WR);
+				}
+				if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+					ssize_t n;
+					while ((n = recv(c.fd, buffer, sizeof(buffer), 0)) > 0)
+						;
+					if (n == 0 || (n < 0 && errno != EAGAIN)) {
+						close(c.fd);
+						c.done = true;
+						remaining--;
+					}
+				}
+			}
+		}
+		double seconds = now() - start;
+		for (size_t i = 0; i < stalled_fds.size(); i++)
+			close(stalled_fds[i]);
+		if (p.open)
+			close(p.fd);
+
+		printf("%d clients, %lu lines, %lu bytes in %.3f s: %.0f lines/s\n",
+		       clients, (unsigned long)lines, (unsigned long)bytes,
+		       seconds, lines / seconds);
+		// PINGs still unanswered count with the time they have waited.
+		for (std::map<unsigned, double>::iterator it = p.sent.begin(); it != p.sent.end(); ++it)
+			p.latencies.push_back(now() - it->second);
+		size_t pings = p.latencies.size();
+		double p50 = percentile(p.latencies, 0.5), p99 = percentile(p.latencies, 0.99);
+		printf("probe: %lu pings, p50 %.1f ms, p99 %.1f ms, max %.1f ms%s\n",
+		       (unsigned long)pings, p50 * 1e3, p99 * 1e3,
+		       percentile(p.latencies, 1) * 1e3, p.open ? "" : ", disconnected");
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
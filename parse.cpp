@@ -8,108 +8,109 @@
 
 // Lexer.
 
-// namespace lex_error {
-// enum type {
-// 	carriage_return_or_line_feed,
-// 	nil,
-// };
-// }
-
-// struct lexeme {
-// 	enum {
-// 		carriage_return_line_feed,
-// 		word,
-
-// 		error,
-// 		nothing,
-// 	} tag;
-// 	union {
-// 		char *word;
-// 		lex_error::type error;
-// 	} value;
-// };
-
-// struct lex_state {
-// 	enum {
-// 		in_word,
-// 		out_of_word,
-// 		carriage_return_found,
-// 	} state;
-// 	std::string word;
-// 	bool in_trailing;
-// };
+static lexeme make_lexeme(lexeme::lexeme_tag tag) {
+	lexeme l;
+	l.tag = tag;
+	l.value.error = lex_error::nil;
+	return l;
+}
+
+static lexeme make_error(lex_error::type error) {
+	lexeme l = make_lexeme(lexeme::error);
+	l.value.error = error;
+	return l;
+}
+
+// Hands the accumulated word over to a lexeme without copying it.
+static lexeme take_word(lex_state *l) {
+	if (l->line_start || l->after_tags) {
+		l->after_tags = l->line_start && !l->word.empty() && l->word[0] == '@';
+		l->line_start = false;
+	}
+	lexeme result = make_lexeme(lexeme::word);
+	result.value.word.swap(l->word);
+	l->word.clear();
+	return result;
+}
+
+lex_state make_lex_state() {
+	lex_state l;
+	l.state = lex_state::in_word;
+	l.in_trailing = false;
+	l.line_start = true;
+	l.after_tags = false;
+	return l;
+}
+
+static void reset(lex_state *l) {
+	l->state = lex_state::in_word;
+	l->word.clear();
+	l->in_trailing = false;
+	l->line_start = true;
+	l->after_tags = false;
+}
 
 lexeme lex(char c, lex_state *l) {
 	if (c == 0)
-		return (lexeme){
-		    .tag = lexeme::error,
-		    .value.error = lex_error::nil,
-		};
+		return make_error(lex_error::nil);
 	if (c == '\n' && l->state != lex_state::carriage_return_found) {
-		return (lexeme){
-		    .tag = lexeme::error,
-		    .value.error = lex_error::carriage_return_or_line_feed,
-		};
+		reset(l);
+		return make_error(lex_error::carriage_return_or_line_feed);
 	}
 
 	switch (l->state) {
 	case lex_state::carriage_return_found:
-		return (lexeme){.tag = lexeme::carriage_return_line_feed};
+		reset(l);
+		if (c != '\n')
+			return make_error(
+			    lex_error::carriage_return_or_line_feed);
+		return make_lexeme(lexeme::carriage_return_line_feed);
 		break;
 	case lex_state::in_word:
 		if (l->in_trailing) {
 			if (c == '\r') {
 				l->state = lex_state::carriage_return_found;
-				char *word = strdup(l->word.c_str());
-				assert(word != 0);
-				return (lexeme){
-				    .tag = lexeme::word,
-				    .value.word = word,
-				};
+				return take_word(l);
 			}
 			l->word += c;
-			return (lexeme){.tag = lexeme::nothing};
+			return make_lexeme(lexeme::nothing);
 		}
 		if (c == '\r') {
-			return (lexeme){
-			    .tag = lexeme::error,
-			    .value.error =
-				lex_error::carriage_return_or_line_feed,
-			};
+			l->state = lex_state::carriage_return_found;
+			if (l->word.empty())
+				return make_lexeme(lexeme::nothing);
+			return take_word(l);
 		}
 		if (c == ' ') {
 			l->state = lex_state::out_of_word;
-			char *word = strdup(l->word.c_str());
-			assert(word != 0);
-			l->word = "";
-			return (lexeme){
-			    .tag = lexeme::word,
-			    .value.word = word,
-			};
+			if (l->word.empty())
+				return make_lexeme(lexeme::nothing);
+			return take_word(l);
 		}
 		l->word += c;
-		return (lexeme){.tag = lexeme::nothing};
+		return make_lexeme(lexeme::nothing);
 		break;
 	case lex_state::out_of_word:
-		if (c == ':') {
+		if (c == ':' && !l->after_tags) {
 			l->in_trailing = true;
 			l->state = lex_state::in_word;
-			return (lexeme){.tag = lexeme::nothing};
+			return make_lexeme(lexeme::nothing);
 		}
 		if (c == ' ') {
-			return (lexeme){.tag = lexeme::nothing};
+			return make_lexeme(lexeme::nothing);
 		}
 		if (c == '\r') {
 			l->state = lex_state::carriage_return_found;
-			return (lexeme){.tag = lexeme::nothing};
+			return make_lexeme(lexeme::nothing);
 		}
 		l->state = lex_state::in_word;
 		l->word += c;
-		return (lexeme){.tag = lexeme::nothing};
+		return make_lexeme(lexeme::nothing);
 		break;
 	}
 	std::cout << "stex\n";
 	assert(0);
+	return make_lexeme(lexeme::nothing);
 }
 
 std::vector<lexeme> lex_string(const char *string, lex_state *state) {
@@ -119,7 +120,7 @@ std::vector<lexeme> lex_string(const char *string, lex_state *state) {
 		char c = string[i];
 		lexeme l = lex(c, state);
 		if (l.tag != lexeme::nothing) {
-			result.push_back(l);
+			result.push_back(IRC_MOVE(l));
 		}
 	}
 	return result;
@@ -127,124 +128,200 @@ std::vector<lexeme> lex_string(const char *string, lex_state *state) {
 
 // Parser.
 
-// struct message {
-// 	char *prefix; // Nilable. Unused.
-// 	char *command;
-// 	char **params;
-// 	int params_count;
-// };
-
-void print_message(message m) {
+void print_message(const message &m) {
 	std::cout << "prefix: " << m.prefix << std::endl
 		  << "command: " << m.command << std::endl
-		  << "params_count: " << m.params_count << std::endl;
-	for (int i = 0; i < m.params_count; i++) {
+		  << "params_count: " << m.params.size() << std::endl;
+	for (size_t i = 0; i < m.params.size(); i++) {
 		std::cout << "\t" << m.params[i] << std::endl;
 	}
 }
 
-// namespace parse_error {
-// enum type {
-// 	no_command,
-// };
-// }
-
-// struct parseme {
-// 	enum parseme_tag {
-// 		nothing,
-// 		message,
-// 		error,
-// 	} tag;
-// 	union {
-// 		::message message;
-// 		parse_error::type error;
-// 	} value;
-// };
-
-// template <class t> struct optional {
-// 	t value;
-// 	bool has_value;
-// };
-
-// struct parse_state {
-// 	optional<std::string> prefix;
-// 	std::vector<std::string> words;
-// };
-
-parseme parse(lexeme l, parse_state *p) {
+parse_state make_parse_state() {
+	parse_state p;
+	p.prefix.has_value = false;
+	return p;
+}
+
+static parseme make_parseme(parseme::parseme_tag tag) {
+	parseme p;
+	p.tag = tag;
+	p.value.error = parse_error::no_command;
+	return p;
+}
+
+static void reset(parse_state *p) {
+	p->tags.clear();
+	p->prefix.has_value = false;
+	p->prefix.value.clear();
+	p->command.clear();
+	p->words.clear();
+}
+
+// Files a word of the line under way into `p`.
+static void parse_word(std::string &word, parse_state *p) {
+	// Only an empty trailing parameter ("QUIT :") lexes as an empty word.
+	if (word.empty()) {
+		if (!p->command.empty())
+			p->words.push_back(std::string());
+	} else if (word[0] == '@' && p->command.empty() &&
+	    !p->prefix.has_value && !p->tags.has_value()) {
+		word.erase(0, 1);
+		p->tags.take(word);
+	} else if (word[0] == ':' && p->command.empty() &&
+	    !p->prefix.has_value) {
+		word.erase(0, 1);
+		p->prefix.has_value = true;
+		p->prefix.value.swap(word);
+	} else if (p->command.empty()) {
+		p->command.swap(word);
+	} else {
+		p->words.push_back(std::string());
+		p->words.back().swap(word);
+	}
+}
+
+parseme parse(lexeme &l, parse_state *p) {
 	switch (l.tag) {
 	case lexeme::carriage_return_line_feed: {
-		if (p->words.size() == 0) {
-			return (parseme){
-			    .tag = parseme::error,
-			    .value.error = parse_error::no_command,
-			};
-		}
-		message m = {
-		    .params_count = p->words.size() - 1,
-		};
-		if (p->prefix.has_value) {
-			m.prefix = strdup(p->prefix.value.c_str());
-			assert(m.prefix != 0);
-		} else {
-			m.prefix = 0;
+		if (p->command.empty()) {
+			reset(p);
+			return make_parseme(parseme::error);
 		}
-		{
-			m.command = strdup(p->words[0].c_str());
-			assert(m.command != 0);
-		}
-		m.params = (char **)malloc(sizeof(*m.params) * m.params_count);
-		assert(m.params != 0);
-		for (unsigned long i = 0; i < p->words.size() - 1; i++) {
-			m.params[i] = strdup(p->words[1 + i].c_str());
-			assert(m.params[i] != 0);
-		}
-		p->prefix = (optional<std::string>){
-		    .has_value = false,
-		};
-		p->words.erase(p->words.begin(), p->words.end());
-		return (parseme){
-		    .tag = parseme::message,
-		    .value.message = m,
-		};
+		parseme result = make_parseme(parseme::message);
+		message &m = result.value.message;
+		m.tags.swap(p->tags);
+		if (p->prefix.has_value)
+			m.prefix.swap(p->prefix.value);
+		m.command.swap(p->command);
+		m.params.swap(p->words);
+		reset(p);
+		// The words went with the message; room for a typical line's
+		// parameters up front saves growing the vector one at a time.
+		p->words.reserve(4);
+		return result;
 		break;
 	}
-	case lexeme::word: {
-		char *word = l.value.word;
-		assert(strlen(word) != 0);
-		if (word[0] == ':') {
-			assert(p->words.size() == 0);
-			char *without_colon = word + 1;
-			assert(without_colon != 0);
-			p->prefix = (optional<std::string>){
-			    .has_value = true,
-			    .value = without_colon,
-			};
-			free(word);
-			return (parseme){.tag = parseme::nothing};
-		} else {
-			p->words.push_back(word);
-			free(word);
-			return (parseme){.tag = parseme::nothing};
-		}
-		break;
+	case lexeme::word:
+		parse_word(l.value.word, p);
+		return make_parseme(parseme::nothing);
+	default: {
+		reset(p);
+		parseme result = make_parseme(parseme::error);
+		result.value.error = parse_error::bad_line;
+		return result;
 	}
-	default:
-		// To-do: handle errors.
-		return (parseme){.tag = parseme::error};
 	}
 }
 
-std::vector<parseme> parse_lexeme_string(std::vector<lexeme> lexemes,
+std::vector<parseme> parse_lexeme_string(std::vector<lexeme> &lexemes,
 					 parse_state *state) {
 	std::vector<parseme> result;
 
 	for (unsigned long i = 0; i < lexemes.size(); i++) {
-		lexeme l = lexemes[i];
-		parseme p = parse(l, state);
+		parseme p = parse(lexemes[i], state);
 		if (p.tag != parseme::nothing) {
-			result.push_back(p);
+			result.push_back(IRC_MOVE(p));
+		}
+	}
+	return result;
+}
+
+static void feed(char c, lex_state *l, parse_state *p,
+		 std::vector<message> &messages) {
+	lexeme token = lex(c, l);
+	if (token.tag == lexeme::nothing)
+		return;
+	// Words only add to the line under way: file them without building
+	// the parseme that parse() would return for them.
+	if (token.tag == lexeme::word) {
+		parse_word(token.value.word, p);
+		return;
+	}
+	parseme result = parse(token, p);
+	if (result.tag != parseme::message)
+		return;
+#if __cplusplus >= 201103L
+	messages.push_back(IRC_MOVE(result.value.message));
+#else
+	messages.push_back(message());
+	message &m = messages.back();
+	m.tags.swap(result.value.message.tags);
+	m.prefix.swap(result.value.message.prefix);
+	m.command.swap(result.value.message.command);
+	m.params.swap(result.value.message.params);
+#endif
+}
+
+void parse_buffer(const char *data, size_t size, lex_state *l, parse_state *p,
+		  std::vector<message> &messages) {
+	for (size_t i = 0; i < size; i++) {
+		// Inside a word, lex() only appends until a delimiter: append the
+		// whole run straight from the read buffer instead.
+		if (l->state == lex_state::in_word) {
+			size_t end = i;
+			while (end < size && data[end] != '\r' && data[end] != '\n'
+			       && data[end] != 0 && (l->in_trailing || data[end] != ' '))
+				end++;
+			l->word.append(data + i, end - i);
+			i = end;
+			if (i == size)
+				break;
+		}
+		if (data[i] == '\n' && l->state != lex_state::carriage_return_found)
+			feed('\r', l, p, messages);
+		feed(data[i], l, p, messages);
+	}
+}
+
+// Tags.
+
+bool get_tag(const std::string &tags, const std::string &key, std::string &value) {
+	size_t start = 0;
+	while (start < tags.size()) {
+		size_t end = tags.find(';', start);
+		if (end == std::string::npos)
+			end = tags.size();
+		size_t key_end = tags.find('=', start);
+		if (key_end > end)
+			key_end = end;
+		if (tags.compare(start, key_end - start, key) == 0) {
+			value.clear();
+			for (size_t i = key_end + 1; i < end; i++) {
+				if (tags[i] != '\\') {
+					value += tags[i];
+					continue;
+				}
+				if (++i == end)
+					break;
+				switch (tags[i]) {
+				case ':': value += ';'; break;
+				case 's': value += ' '; break;
+				case 'r': value += '\r'; break;
+				case 'n': value += '\n'; break;
+				default: value += tags[i];
+				}
+			}
+			return true;
+		}
+		start = end + 1;
+	}
+	return false;
+}
+
+std::string client_tags(const std::string &tags) {
+	std::string result;
+	size_t start = 0;
+	while (start < tags.size()) {
+		size_t end = tags.find(';', start);
+		if (end == std::string::npos)
+			end = tags.size();
+		if (tags[start] == '+') {
+			if (!result.empty())
+				result += ';';
+			result.append(tags, start, end - start);
 		}
+		start = end + 1;
 	}
 	return result;
 }
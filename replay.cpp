@@ -0,0 +1,163 @@
+#include "Capture.hpp"
+#include "Clock.hpp"
+#include "Server.hpp"
+#include <cerrno>
+#include <cstdlib>
+
+// Feeds a capture made with IRCSERV_CAPTURE back through a Server in this
+// process. Every captured connection becomes one end of a socketpair whose
+// other end is handed to the server, so the server runs its normal poll,
+// recv, parse, dispatch and send path. By default records are delivered as
+// fast as the server takes them; with --paced they keep their recorded
+// spacing. Prints throughput and the time spent per command. With
+// --transcript, everything the server sent is written to a file at the end,
+// each line behind the number of the connection it went to.
+
+static bool keep_transcript = false;
+static std::map<uint32_t, std::string> transcript;
+
+static void drain(std::map<uint32_t, int> &ends) {
+	char buffer[4096];
+	for (std::map<uint32_t, int>::iterator it = ends.begin(); it != ends.end(); ++it) {
+		ssize_t n;
+		while ((n = recv(it->second, buffer, sizeof(buffer), 0)) > 0) {
+			if (keep_transcript)
+				transcript[it->first].append(buffer, n);
+		}
+	}
+}
+
+static void write_transcript(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		throw std::runtime_error(std::string("Unable to open ") + path);
+	for (std::map<uint32_t, std::string>::iterator it = transcript.begin(); it != transcript.end(); ++it) {
+		const std::string &text = it->second;
+		size_t start = 0;
+		while (start < text.size()) {
+			size_t end = text.find('\n', start);
+			if (end == std::string::npos)
+				end = text.size();
+			size_t length = end - start;
+			if (length > 0 && text[end - 1] == '\r')
+				length--;
+			fprintf(file, "%u %.*s\n", (unsigned)it->first, (int)length, text.data() + start);
+			start = end + 1;
+		}
+	}
+	fclose(file);
+}
+
+static void pump(Server &server, std::map<uint32_t, int> &ends, int timeout) {
+	server.poll_once(timeout);
+	drain(ends);
+}
+
+static void deliver(Server &server, std::map<uint32_t, int> &ends, int fd, const std::string &data) {
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t n = send(fd, data.data() + written, data.size() - written, 0);
+		if (n > 0) {
+			written += n;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			pump(server, ends, 0);
+		} else {
+			return; // The server closed this connection.
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	bool paced = false;
+	const char *transcript_path = NULL;
+	bool usage = argc < 3;
+	for (int i = 3; i < argc && !usage; ++i) {
+		std::string option = argv[i];
+		if (option == "--paced")
+			paced = true;
+		else if (option == "--transcript" && i + 1 < argc)
+			transcript_path = argv[++i];
+		else
+			usage = true;
+	}
+	if (usage) {
+		std::cerr << "Usage: ./replay <capture file> <password> [--paced] [--transcript <file>]" << std::endl;
+		return 1;
+	}
+	keep_transcript = transcript_path != NULL;
+	signal(SIGPIPE, SIG_IGN);
+	std::cout.setstate(std::ios::failbit); // Connect/disconnect chatter.
+
+	try {
+		FILE *file = fopen(argv[1], "rb");
+		if (file == NULL)
+			throw std::runtime_error(std::string("Unable to open ") + argv[1]);
+		Capture::read_header(file);
+
+		Server server("0", argv[2]);
+		server.enable_command_stats();
+		std::map<uint32_t, int> ends;
+		Capture::record r;
+		unsigned long records = 0, bytes = 0;
+		uint64_t start = monotonic_nanoseconds();
+
+		while (Capture::read_record(file, r)) {
+			records++;
+			while (paced && monotonic_nanoseconds() - start < r.time) {
+				uint64_t wait = (r.time - (monotonic_nanoseconds() - start)) / 1000000;
+				pump(server, ends, wait > 100 ? 100 : (int)wait);
+			}
+
+			if (r.type == Capture::connect) {
+				int pair[2];
+				if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+					throw std::runtime_error("Unable to create a socketpair.");
+				fcntl(pair[1], F_SETFL, O_NONBLOCK);
+				server.add_client(pair[0], 0, r.data);
+				ends[r.connection] = pair[1];
+			} else if (r.type == Capture::data) {
+				std::map<uint32_t, int>::iterator it = ends.find(r.connection);
+				if (it != ends.end())
+					deliver(server, ends, it->second, r.data);
+				bytes += r.data.size();
+			} else if (r.type == Capture::disconnect) {
+				std::map<uint32_t, int>::iterator it = ends.find(r.connection);
+				if (it != ends.end()) {
+					close(it->second);
+					ends.erase(it);
+				}
+			}
+			pump(server, ends, 0);
+		}
+		fclose(file);
+
+		for (std::map<uint32_t, int>::iterator it = ends.begin(); it != ends.end(); ++it)
+			close(it->second);
+		ends.clear();
+		while (server.client_count() != 0)
+			pump(server, ends, 0);
+		// Whatever a client still had queued goes with it.
+		if (server.queued_output() != 0)
+			throw std::runtime_error("Error: Output accounting leaked bytes");
+		double seconds = (monotonic_nanoseconds() - start) / 1e9;
+
+		const std::map<std::string, command_stat> &stats = server.get_command_stats();
+		unsigned long messages = 0;
+		for (std::map<std::string, command_stat>::const_iterator it = stats.begin(); it != stats.end(); ++it)
+			messages += it->second.count;
+		printf("%lu records, %lu bytes, %lu commands in %.3f s: %.0f commands/s, %.1f MB/s\n",
+		       records, bytes, messages, seconds, messages / seconds, bytes / seconds / 1e6);
+		printf("%-10s %10s %12s %12s\n", "command", "count", "mean us", "max us");
+		for (std::map<std::string, command_stat>::const_iterator it = stats.begin(); it != stats.end(); ++it) {
+			const command_stat &s = it->second;
+			printf("%-10s %10lu %12.2f %12.2f\n", it->first.c_str(), s.count,
+			       s.total_nanoseconds / 1e3 / s.count, s.max_nanoseconds / 1e3);
+		}
+		if (transcript_path)
+			write_transcript(transcript_path);
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,14 +1,43 @@
 #include "dispatch.cpp"
+#include "ChannelLog.hpp"
+#include "CidrTrie.hpp"
+#include "Compressor.hpp"
+#include "History.hpp"
+#include "MaskSet.hpp"
+#include "Overload.hpp"
 #include "Parser.hpp"
+#include "Text.hpp"
+#include "Tls.hpp"
+#include <algorithm>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Log lines of channel in [from, to), the slow way.
+static size_t count_between(const std::vector<ChannelLog::entry> &all, uint64_t from, uint64_t to) {
+	size_t count = 0;
+	for (size_t i = 0; i < all.size(); i++)
+		count += all[i].time >= from && all[i].time < to;
+	return count;
+}
+
+static std::vector<std::string> list_directory(const std::string &path) {
+	std::vector<std::string> names;
+	DIR *dir = opendir(path.c_str());
+	while (dirent *d = readdir(dir)) {
+		if (d->d_name[0] != '.')
+			names.push_back(path + "/" + d->d_name);
+	}
+	closedir(dir);
+	return names;
+}
 
 int main() {
 	// Lex.
 
-	lex_state state = {
-	    .state = lex_state::in_word,
-	    .word = "",
-	    .in_trailing = false,
-	};
+	lex_state state = make_lex_state();
 
 	std::vector<lexeme> lexemes =
 	    lex_string(":Nickname!username@hostname.com PRIVMSG #channel :Hello everyone! How are you today?\r\n",
@@ -17,28 +46,25 @@ int main() {
 		{
 			lexeme l = lexemes[0];
 			assert(l.tag == lexeme::word &&
-			       strcmp(l.value.word,
-				      ":Nickname!username@hostname.com") == 0);
+			       l.value.word == ":Nickname!username@hostname.com");
 		}
 
 		{
 			lexeme l = lexemes[1];
 			assert(l.tag == lexeme::word &&
-			       strcmp(l.value.word, "PRIVMSG") == 0);
+			       l.value.word == "PRIVMSG");
 		}
 
 		{
 			lexeme l = lexemes[2];
 			assert(l.tag == lexeme::word &&
-			       strcmp(l.value.word, "#channel") == 0);
+			       l.value.word == "#channel");
 		}
 
 		{
 			lexeme l = lexemes[3];
 			assert(l.tag == lexeme::word &&
-			       strcmp(l.value.word,
-				      "Hello everyone! How are you today?") ==
-				   0);
+			       l.value.word == "Hello everyone! How are you today?");
 		}
 
 		{
@@ -54,12 +80,7 @@ int main() {
 	// Parse.
 
 	{
-		parse_state p = {
-		    .prefix =
-			{
-			    .has_value = false,
-			},
-		};
+		parse_state p = make_parse_state();
 
 		std::vector<parseme> parsemes =
 		    parse_lexeme_string(lexemes, &p);
@@ -67,18 +88,569 @@ int main() {
 		assert(parsemes.size() == 1 &&
 		       parsemes[0].tag == parseme::message);
 
-		message m = parsemes[0].value.message;
+		const message &m = parsemes[0].value.message;
 
-		assert(strcmp(m.prefix, "Nickname!username@hostname.com") == 0);
-		assert(strcmp(m.command, "PRIVMSG") == 0);
-		assert(m.params_count == 2);
-		assert(strcmp(m.params[0], "#channel") == 0);
-		assert(strcmp(m.params[1],
-			      "Hello everyone! How are you today?") == 0);
+		assert(m.prefix == "Nickname!username@hostname.com");
+		assert(m.command == "PRIVMSG");
+		assert(m.params.size() == 2);
+		assert(m.params[0] == "#channel");
+		assert(m.params[1] == "Hello everyone! How are you today?");
 
 		printf("parse test: ok\n");
 	}
 
+	// Consecutive lines through one lexer and parser.
+
+	{
+		lex_state l = make_lex_state();
+		parse_state p = make_parse_state();
+
+		std::vector<lexeme> lexemes =
+		    lex_string("NICK alice\r\nUSER a 0 * :Alice A\r\nPING\r\n", &l);
+		std::vector<parseme> parsemes = parse_lexeme_string(lexemes, &p);
+
+		assert(parsemes.size() == 3);
+		assert(parsemes[0].value.message.command == "NICK" &&
+		       parsemes[0].value.message.params.size() == 1 &&
+		       parsemes[0].value.message.params[0] == "alice");
+		assert(parsemes[1].value.message.command == "USER" &&
+		       parsemes[1].value.message.params.size() == 4 &&
+		       parsemes[1].value.message.params[3] == "Alice A");
+		assert(parsemes[2].value.message.command == "PING" &&
+		       parsemes[2].value.message.params.empty() &&
+		       parsemes[2].value.message.prefix.empty());
+
+		printf("stream test: ok\n");
+	}
+
+	// A line split over two reads, and a bare LF.
+
+	{
+		lex_state l = make_lex_state();
+		parse_state p = make_parse_state();
+		std::vector<message> messages;
+
+		parse_buffer("PRIVMSG #chan :hel", 18, &l, &p, messages);
+		assert(messages.empty());
+		parse_buffer("lo\r\nJOIN #b\n", 13, &l, &p, messages);
+
+		assert(messages.size() == 2);
+		assert(messages[0].command == "PRIVMSG" &&
+		       messages[0].params[1] == "hello");
+		assert(messages[1].command == "JOIN" &&
+		       messages[1].params.size() == 1 &&
+		       messages[1].params[0] == "#b");
+
+		printf("buffer test: ok\n");
+	}
+
+	// parse_buffer takes words in runs; it has to agree with lex(), which
+	// goes byte by byte, wherever the reads are split.
+
+	{
+		const char *stream = ":nick!u@h PRIVMSG  #a :two  spaces: here\r\n"
+				     "MODE #a +k key\r\nQUIT :\r\n";
+		lex_state l = make_lex_state();
+		parse_state p = make_parse_state();
+		std::vector<lexeme> lexemes = lex_string(stream, &l);
+		std::vector<parseme> expected = parse_lexeme_string(lexemes, &p);
+
+		size_t size = strlen(stream);
+		for (size_t split = 0; split <= size; split++) {
+			lex_state l = make_lex_state();
+			parse_state p = make_parse_state();
+			std::vector<message> messages;
+			parse_buffer(stream, split, &l, &p, messages);
+			parse_buffer(stream + split, size - split, &l, &p, messages);
+
+			assert(messages.size() == expected.size());
+			for (size_t i = 0; i < messages.size(); i++) {
+				const message &m = expected[i].value.message;
+				assert(messages[i].prefix == m.prefix &&
+				       messages[i].command == m.command &&
+				       messages[i].params == m.params);
+			}
+		}
+		assert(expected.size() == 3 &&
+		       expected[0].value.message.params[1] == "two  spaces: here");
+
+		printf("split test: ok\n");
+	}
+
+	// IRCv3 tags: kept raw on the message, looked up and unescaped on
+	// request.
+
+	{
+		lex_state l = make_lex_state();
+		parse_state p = make_parse_state();
+		std::vector<message> messages;
+		const char *lines =
+		    "@+draft/reply=a\\:b\\sc\\\\;label;time=x :nick!u@h PRIVMSG #c :hi\r\n"
+		    "PRIVMSG #c :@not tags\r\n"
+		    "@+typing=active TAGMSG #c\r\n";
+		parse_buffer(lines, strlen(lines), &l, &p, messages);
+		assert(messages.size() == 3);
+
+		const message &tagged = messages[0];
+		assert(tagged.tags.str() == "+draft/reply=a\\:b\\sc\\\\;label;time=x");
+		assert(tagged.prefix == "nick!u@h" && tagged.command == "PRIVMSG");
+		assert(tagged.params.size() == 2 && tagged.params[1] == "hi");
+		std::string value;
+		assert(get_tag(tagged.tags, "+draft/reply", value) && value == "a;b c\\");
+		assert(get_tag(tagged.tags, "label", value) && value.empty());
+		assert(get_tag(tagged.tags, "time", value) && value == "x");
+		assert(!get_tag(tagged.tags, "tim", value) && !get_tag(tagged.tags, "+draft", value));
+		assert(get_tag("k=x\\ry\\nz\\q\\", "k", value) && value == "x\ry\nzq");
+		assert(client_tags(tagged.tags) == "+draft/reply=a\\:b\\sc\\\\");
+
+		assert(messages[1].tags.empty() && messages[1].params[1] == "@not tags");
+		assert(messages[2].command == "TAGMSG" && messages[2].params.size() == 1);
+		assert(client_tags(messages[2].tags) == "+typing=active");
+		assert(client_tags("a=1;b") == "");
+
+		printf("tags test: ok\n");
+	}
+
+	// Text: every kernel the CPU has agrees with the scalar versions, on
+	// every two-byte string, at the edges of 16 and 32 byte blocks, and on
+	// random mixes of sequences with bytes broken.
+
+	{
+		assert(valid_utf8_scalar("", 0));
+		assert(valid_utf8_scalar("caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80", 14));
+		assert(!valid_utf8_scalar("\xC0\xAF", 2));            // Overlong.
+		assert(!valid_utf8_scalar("\xED\xA0\x80", 3));        // Surrogate.
+		assert(!valid_utf8_scalar("\xF4\x90\x80\x80", 4));   // Above U+10FFFF.
+		assert(!valid_utf8_scalar("\xE2\x82", 2));            // Cut short.
+		assert(!valid_utf8_scalar("\x80", 1));
+		char folded[6];
+		fold_name_scalar("[Ab]\\^", 6, folded);
+		assert(memcmp(folded, "{ab}|~", 6) == 0);
+
+		const char *pieces[] = {
+		    "a", " ", "~", "\xC3\xA9", "\xDF\xBF", "\xE0\xA0\x80", "\xED\x9F\xBF",
+		    "\xEF\xBF\xBF", "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF", "[", "Z",
+		};
+		text_kernel best = best_text_kernel();
+		for (int k = text_scalar; k <= best; k++) {
+			use_text_kernel(static_cast<text_kernel>(k));
+			for (size_t offset = 0; offset < 40; offset += offset == 0 ? 13 : 1) {
+				if (offset > 18 && offset < 29)
+					continue;
+				std::string s(offset + 2, 'x');
+				for (unsigned pair = 0; pair < 0x10000; pair++) {
+					s[offset] = pair >> 8;
+					s[offset + 1] = pair & 0xFF;
+					assert(valid_utf8(s) == valid_utf8_scalar(s.data(), s.size()));
+				}
+			}
+			uint32_t seed = 7;
+			for (int round = 0; round < 20000; round++) {
+				std::string s;
+				seed = seed * 1103515245 + 12345;
+				size_t count = (seed >> 16) % 40;
+				for (size_t i = 0; i < count; i++) {
+					seed = seed * 1103515245 + 12345;
+					s += pieces[(seed >> 16) % (sizeof(pieces) / sizeof(*pieces))];
+				}
+				seed = seed * 1103515245 + 12345;
+				if (!s.empty() && (seed >> 16) % 2)
+					s[(seed >> 8) % s.size()] = static_cast<char>(seed >> 24);
+				assert(valid_utf8(s) == valid_utf8_scalar(s.data(), s.size()));
+				std::string expected(s.size(), '\0');
+				if (!s.empty())
+					fold_name_scalar(s.data(), s.size(), &expected[0]);
+				assert(fold_name(s) == expected);
+			}
+		}
+		use_text_kernel(best);
+		assert(MaskSet::casefold("NICK[1]") == "nick{1}");
+
+		printf("text test (%s): ok\n", text_kernel_name(best));
+	}
+
+	// Masks: a MaskSet agrees with trying each mask on its own.
+
+	{
+		const char *masks[] = {
+		    "nick!*@*", "*!*@*.example.net", "*!ident@host?", "a*b*c!*@*",
+		    "*!*@10.0.*.1", "[Away]!*@*", "exact!user@host", "*!*x*@*",
+		    "?\?!*@*",
+		};
+		const char *sources[] = {
+		    "nick!u@h", "NICK!u@h", "x!y@irc.example.net", "x!y@example.net",
+		    "x!ident@host1", "x!ident@host12", "abxbc!u@h", "acb!u@h",
+		    "x!y@10.0.77.1", "x!y@10.0.77.2", "{away}!u@h", "exact!user@host",
+		    "exact!user@hosts", "me!axb@h", "ab!u@h", "abc!u@h", "",
+		};
+		size_t mask_count = sizeof(masks) / sizeof(*masks);
+		size_t source_count = sizeof(sources) / sizeof(*sources);
+
+		assert(MaskSet::casefold("[A]\\^") == "{a}|~");
+		assert(MaskSet::match("[away]!*@*", "{AWAY}!u@h"));
+		for (size_t n = 1; n <= mask_count; n++) {
+			MaskSet set;
+			for (size_t i = 0; i < n; i++)
+				set.add(masks[i]);
+			for (size_t k = 0; k < source_count; k++) {
+				bool expected = false;
+				for (size_t i = 0; i < n; i++)
+					expected = expected || MaskSet::match(masks[i], sources[k]);
+				assert(set.matches(sources[k]) == expected);
+			}
+		}
+
+		MaskSet set;
+		assert(set.add("Nick!*@*") && !set.add("NICK!*@*"));
+		assert(set.matches("nick!a@b"));
+		assert(!set.remove("other!*@*") && set.remove("nick!*@*"));
+		assert(!set.matches("nick!a@b") && set.size() == 0);
+		set.add("*");
+		assert(set.matches("") && set.matches("anyone!a@b"));
+
+		printf("mask test: ok\n");
+	}
+
+	// CIDR trie: longest match over mixed IPv4/IPv6 prefixes, and
+	// counters that come and go.
+
+	{
+		CidrTrie trie;
+		ip_address a;
+		unsigned length;
+		const char *prefixes[] = {"10.0.0.0/8", "10.1.0.0/16", "10.1.2.3",
+					  "2001:db8::/32", "2001:db8:1::/48", "::1"};
+		for (long i = 0; i < 6; i++) {
+			assert(CidrTrie::parse(prefixes[i], a, length));
+			trie.at(a, length) = i + 1;
+		}
+		assert(trie.size() == 6);
+
+		const char *addresses[] = {"10.9.9.9", "10.1.9.9", "10.1.2.3",
+					   "2001:db8:2::1", "2001:db8:1::1", "192.0.2.1",
+					   "::1"};
+		long expected[] = {1, 2, 3, 4, 5, 0, 6};
+		for (int i = 0; i < 7; i++) {
+			assert(CidrTrie::parse(addresses[i], a, length) && length == 128);
+			const long *value = trie.longest_match(a);
+			assert(expected[i] == 0 ? value == NULL : value && *value == expected[i]);
+		}
+		assert(CidrTrie::parse("10.1.2.3", a, length) && a.is_v4());
+		assert(trie.find(a, 96 + 16) && *trie.find(a, 96 + 16) == 2);
+		assert(trie.find(a, 96 + 17) == NULL);
+
+		assert(CidrTrie::parse("10.1.0.0/16", a, length));
+		assert(trie.erase(a, length) && !trie.erase(a, length));
+		assert(CidrTrie::parse("10.1.9.9", a, length));
+		assert(*trie.longest_match(a) == 1);
+		assert(CidrTrie::parse("10.1.2.3", a, length));
+		assert(*trie.longest_match(a) == 3);
+		assert(!CidrTrie::parse("10.0.0.0/33", a, length));
+		assert(!CidrTrie::parse("example.net", a, length));
+
+		trie.clear();
+		for (int i = 0; i < 256; i++) {
+			char text[32];
+			snprintf(text, sizeof(text), "192.0.2.%d", i);
+			assert(CidrTrie::parse(text, a, length));
+			trie.at(a, length)++;
+			trie.at(a.prefix(96 + 24), 96 + 24)++;
+		}
+		assert(trie.size() == 257 && *trie.find(a, 96 + 24) == 256);
+		for (int i = 0; i < 256; i++) {
+			char text[32];
+			snprintf(text, sizeof(text), "192.0.2.%d", i);
+			assert(CidrTrie::parse(text, a, length));
+			assert(trie.erase(a, length));
+		}
+		assert(trie.size() == 1 && trie.longest_match(a) && *trie.longest_match(a) == 256);
+
+		printf("cidr test: ok\n");
+	}
+
+	// History.
+
+	{
+		History history(2 * HISTORY_RING_SIZE);
+		std::string out;
+		assert(history.replay("#a", 10, out) == 0 && out.empty());
+		for (int i = 0; i < HISTORY_LINES + 5; i++) {
+			char text[32];
+			snprintf(text, sizeof(text), "line %d", i);
+			history.append("#a", text);
+		}
+		assert(history.size("#a") == HISTORY_LINES);
+		assert(history.replay("#a", 2, out) == 2);
+		char expected[64];
+		snprintf(expected, sizeof(expected), "line %d\r\nline %d\r\n",
+			 HISTORY_LINES + 3, HISTORY_LINES + 4);
+		assert(out == expected);
+
+		// Long lines wrap around the end of the ring and push out the
+		// oldest ones; replay puts them back together.
+		std::string long_line(HISTORY_RING_SIZE / 3, 'x');
+		for (int i = 0; i < 10; i++) {
+			long_line[0] = 'a' + i;
+			history.append("#b", long_line);
+		}
+		assert(history.size("#b") == 2);
+		out.clear();
+		assert(history.replay("#b", 10, out) == 2);
+		long_line[0] = 'i';
+		std::string last_two = long_line + "\r\n";
+		long_line[0] = 'j';
+		last_two += long_line + "\r\n";
+		assert(out == last_two);
+		history.append("#b", std::string(HISTORY_RING_SIZE, 'y'));
+		assert(history.size("#b") == 2);
+
+		// Two rings: #b was used last, so #c takes the ring of #a.
+		history.append("#c", "hello");
+		assert(history.size("#a") == 0 && history.size("#b") == 2 && history.size("#c") == 1);
+		out.clear();
+		history.replay("#b", 1, out);
+		history.append("#d", "hello");
+		assert(history.size("#c") == 0 && history.size("#b") == 2);
+		assert(history.get_stats().evicted == 2 && history.get_stats().channels == 2);
+
+		printf("history test: ok\n");
+	}
+
+	// Channel log.
+
+	{
+		char directory[] = "/tmp/ircserv-test-XXXXXX";
+		assert(mkdtemp(directory));
+		const size_t lines = 200000;
+		const uint64_t end = (uint64_t)-1;
+		ChannelLog *log = new ChannelLog(directory);
+		for (size_t i = 0; i < lines; i++) {
+			char text[128];
+			snprintf(text, sizeof(text), ":nick!user@host PRIVMSG #a :line %lu of the channel log test, "
+				 "long enough to fill a segment", (unsigned long)i);
+			log->append("#a", text);
+			if (i % 100 == 0)
+				log->append("#b", text);
+		}
+		assert(log->get_stats().records == lines + lines / 100);
+		assert(log->get_stats().rotations >= 1);
+
+		std::vector<ChannelLog::entry> all;
+		log->read("#a", 0, end, lines * 2, false, all);
+		assert(all.size() == lines && all[0].line.find("line 0 ") != std::string::npos);
+		assert(all[lines - 1].line.find("line 199999 ") != std::string::npos);
+		for (size_t i = 1; i < all.size(); i++)
+			assert(all[i - 1].time <= all[i].time);
+
+		std::vector<ChannelLog::entry> some;
+		log->read("#a", 0, end, 3, true, some);
+		assert(some.size() == 3 && some[2].line == all[lines - 1].line && some[0].line == all[lines - 3].line);
+		const size_t points[] = {0, 1000, 99999, 150000, lines - 1};
+		for (size_t i = 0; i < 5; i++) {
+			for (size_t j = i; j < 5; j++) {
+				uint64_t from = all[points[i]].time, to = all[points[j]].time;
+				some.clear();
+				log->read("#a", from, to, lines, false, some);
+				assert(some.size() == count_between(all, from, to));
+				assert(some.empty() || some[0].time >= from);
+				some.clear();
+				log->read("#a", from, to, 7, true, some);
+				std::vector<std::string> expected;
+				for (size_t k = 0; k < all.size(); k++) {
+					if (all[k].time >= from && all[k].time < to)
+						expected.push_back(all[k].line);
+				}
+				if (expected.size() > 7)
+					expected.erase(expected.begin(), expected.end() - 7);
+				assert(some.size() == expected.size());
+				for (size_t k = 0; k < some.size(); k++)
+					assert(some[k].line == expected[k]);
+			}
+		}
+		some.clear();
+		log->read("#a", all[1000].time, end, 2, false, some);
+		assert(some.size() == 2 && some[0].time == all[1000].time);
+		some.clear();
+		log->read("#c", 0, end, 10, false, some);
+		assert(some.empty());
+		delete log;
+
+		// A second run finds the segments; one without its index gets
+		// scanned again.
+		std::vector<std::string> files = list_directory(directory);
+		for (size_t i = 0; i < files.size(); i++) {
+			if (files[i].find(".idx") != std::string::npos) {
+				unlink(files[i].c_str());
+				break;
+			}
+		}
+		log = new ChannelLog(directory);
+		std::vector<ChannelLog::entry> again;
+		log->read("#a", 0, end, lines * 2, false, again);
+		assert(again.size() == lines && again[lines - 1].line == all[lines - 1].line);
+		again.clear();
+		log->read("#b", 0, end, lines, false, again);
+		assert(again.size() == lines / 100);
+		log->append("#a", "after the restart");
+		again.clear();
+		log->read("#a", 0, end, 1, true, again);
+		assert(again.size() == 1 && again[0].line == "after the restart" && again[0].time >= all[lines - 1].time);
+		delete log;
+
+		// A rotation can number its segment ahead of the spare the
+		// thread is still creating. Swap the first two segments of a
+		// shard to get that: reads still come out in time order.
+		std::vector<std::string> segments;
+		files = list_directory(directory);
+		for (size_t i = 0; i < files.size(); i++) {
+			if (files[i].size() > 4 && files[i].compare(files[i].size() - 4, 4, ".log") == 0)
+				segments.push_back(files[i]);
+		}
+		std::sort(segments.begin(), segments.end());
+		std::string first, second;
+		for (size_t i = 0; i + 1 < segments.size() && first.empty(); i++) {
+			std::string shard = segments[i].substr(0, segments[i].rfind('-'));
+			if (segments[i + 1].compare(0, shard.size() + 1, shard + "-") == 0) {
+				first = segments[i];
+				second = segments[i + 1];
+			}
+		}
+		assert(!first.empty());
+		std::string swapped = first + ".swap";
+		assert(rename(first.c_str(), swapped.c_str()) == 0 && rename(second.c_str(), first.c_str()) == 0
+		       && rename(swapped.c_str(), second.c_str()) == 0);
+		assert(rename((first + ".idx").c_str(), (swapped + ".idx").c_str()) == 0
+		       && rename((second + ".idx").c_str(), (first + ".idx").c_str()) == 0
+		       && rename((swapped + ".idx").c_str(), (second + ".idx").c_str()) == 0);
+		log = new ChannelLog(directory);
+		again.clear();
+		log->read("#a", 0, end, lines * 2, false, again);
+		assert(again.size() == lines + 1 && again[lines].line == "after the restart");
+		for (size_t i = 1; i < again.size(); i++)
+			assert(again[i - 1].time <= again[i].time);
+		delete log;
+
+		files = list_directory(directory);
+		for (size_t i = 0; i < files.size(); i++)
+			unlink(files[i].c_str());
+		rmdir(directory);
+		printf("log test: ok\n");
+	}
+
+	// Compression.
+
+	{
+		// Each batch decodes on its own, as soon as it arrives.
+		Compressor compressor;
+		z_stream in = {};
+		assert(inflateInit(&in) == Z_OK);
+		const char *batches[] = {
+		    ":a!u@h PRIVMSG #channel :hello\r\n",
+		    ":a!u@h PRIVMSG #channel :hello again\r\n:b!u@h JOIN :#channel\r\n",
+		    "",
+		    ":server 353 b = #channel :@a b\r\n",
+		};
+		size_t compressed_size = 0, plain_size = 0;
+		for (size_t i = 0; i < sizeof(batches) / sizeof(*batches); i++) {
+			std::string wire = "x";
+			compressor.compress(batches[i], strlen(batches[i]), wire);
+			assert(wire[0] == 'x');
+			compressed_size += wire.size() - 1;
+			plain_size += strlen(batches[i]);
+
+			char plain[256];
+			in.next_in = reinterpret_cast<Bytef *>(&wire[1]);
+			in.avail_in = wire.size() - 1;
+			in.next_out = reinterpret_cast<Bytef *>(plain);
+			in.avail_out = sizeof(plain);
+			int status = inflate(&in, Z_SYNC_FLUSH);
+			if (status == Z_NEED_DICT) {
+				const std::string &words = Compressor::dictionary();
+				assert(in.adler == adler32(1, reinterpret_cast<const Bytef *>(words.data()), words.size()));
+				inflateSetDictionary(&in, reinterpret_cast<const Bytef *>(words.data()), words.size());
+				status = inflate(&in, Z_SYNC_FLUSH);
+			}
+			assert(status == Z_OK || status == Z_BUF_ERROR);
+			assert(in.avail_in == 0);
+			assert(std::string(plain, sizeof(plain) - in.avail_out) == batches[i]);
+		}
+		inflateEnd(&in);
+
+		// More than fits in the first guess at the output size.
+		std::string big, wire;
+		for (uint32_t seed = 1; big.size() < 200000; seed = seed * 1103515245 + 12345)
+			big += static_cast<char>(seed >> 24);
+		Compressor unprimed(COMPRESS_LEVEL, false);
+		unprimed.compress(big.data(), big.size(), wire);
+		std::string back(big.size(), '\0');
+		uLongf size = back.size();
+		assert(uncompress(reinterpret_cast<Bytef *>(&back[0]), &size,
+				  reinterpret_cast<const Bytef *>(wire.data()), wire.size()) != Z_DATA_ERROR);
+		assert(size == big.size() && back == big);
+		printf("compress test: ok\n");
+	}
+
+	// TLS.
+
+	{
+		// Both ends in this thread on a non-blocking socket pair, taking
+		// turns until the handshake is done. Unix sockets have no kTLS,
+		// so records stay in user space.
+		int pair[2];
+		assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) == 0);
+		TlsContext *context = TlsContext::self_signed("test.example.org");
+		TlsSession server(context->wrap(pair[0]));
+		SSL_CTX *client_context = SSL_CTX_new(TLS_client_method());
+		SSL *client = SSL_new(client_context);
+		SSL_set_fd(client, pair[1]);
+		SSL_set_connect_state(client);
+		TlsSession::status status = TlsSession::want_read;
+		for (int turn = 0; turn < 20 && status != TlsSession::ok; turn++) {
+			SSL_do_handshake(client);
+			status = server.handshake();
+			assert(status != TlsSession::failed);
+		}
+		assert(status == TlsSession::ok && server.is_established());
+		assert(!server.sends_in_kernel() && !server.receives_in_kernel());
+		SSL_do_handshake(client);
+
+		size_t done;
+		char buffer[64];
+		assert(server.read(buffer, sizeof(buffer), done) == TlsSession::want_read);
+		assert(SSL_write(client, "PING :x\r\n", 9) == 9);
+		assert(server.read(buffer, sizeof(buffer), done) == TlsSession::ok);
+		assert(std::string(buffer, done) == "PING :x\r\n");
+		assert(server.write("PONG :x\r\n", 9, done) == TlsSession::ok && done == 9);
+		int got = SSL_read(client, buffer, sizeof(buffer));
+		assert(got == 9 && std::string(buffer, got) == "PONG :x\r\n");
+
+		// The peer's close_notify reads as closed.
+		SSL_shutdown(client);
+		assert(server.read(buffer, sizeof(buffer), done) == TlsSession::closed);
+		SSL_free(client);
+		SSL_CTX_free(client_context);
+		close(pair[1]);
+		close(pair[0]);
+		delete context;
+		printf("tls test: ok\n");
+	}
+
+	// Overload: running out of descriptors pauses accepts for a while.
+
+	{
+		Overload overload;
+		assert(overload.update(0, 0) == Overload::normal);
+		assert(overload.out_of_descriptors() && !overload.accepting());
+		assert(!overload.out_of_descriptors());
+		overload.accepted();
+		assert(overload.out_of_descriptors());
+		assert(overload.update(0, 0) == Overload::pause_accepts);
+		usleep(DESCRIPTOR_PAUSE_NANOSECONDS / 1000 + 10000);
+		assert(overload.update(0, 0) == Overload::normal && overload.accepting());
+		assert(overload.get_stats().accept_pauses == 1 && overload.get_stats().descriptor_pauses == 1);
+		printf("overload test: ok\n");
+	}
+
 	// // Dispatch.
 
 	// {
@@ -1,14 +1,124 @@
 #include "Server.hpp"
 #include "Parser.hpp"
+#include <cstdlib>
 
 int main(int argc, char **argv) {
 
 	if(argc != 3)
 		throw std::runtime_error("Usage: ./ircserv <port> <password>");
 	Server server(argv[1], argv[2]);
+	signal(SIGINT, Server::handle_signal);
+	signal(SIGTERM, Server::handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+	// IRCSERV_CAPTURE=<file> records all inbound traffic for ./replay.
+	if (getenv("IRCSERV_CAPTURE"))
+		server.enable_capture(getenv("IRCSERV_CAPTURE"));
+	// IRCSERV_IO=poll keeps the poll loop even where io_uring works.
+	if (getenv("IRCSERV_IO") && std::string(getenv("IRCSERV_IO")) == "poll")
+		server.use_poll();
 
 	try {
+		// IRCSERV_NAME=<name> names this server on the network, and
+		// IRCSERV_LINKS=<file> lists the servers it links with.
+		if (getenv("IRCSERV_NAME"))
+			server.set_name(getenv("IRCSERV_NAME"));
+		if (getenv("IRCSERV_LINKS"))
+			server.load_links(getenv("IRCSERV_LINKS"));
+		// IRCSERV_LOG=<directory> logs all channel traffic there.
+		if (getenv("IRCSERV_LOG"))
+			server.enable_log(getenv("IRCSERV_LOG"));
+		// IRCSERV_KLINES=<file> refuses the user@host masks listed in it.
+		if (getenv("IRCSERV_KLINES"))
+			server.load_klines(getenv("IRCSERV_KLINES"));
+		// IRCSERV_DLINES=<file> refuses connections from the addresses and
+		// CIDR prefixes listed in it.
+		if (getenv("IRCSERV_DLINES"))
+			server.load_dlines(getenv("IRCSERV_DLINES"));
+		// IRCSERV_EXEMPT=<file> lifts the per-address and per-subnet
+		// connection caps for the prefixes listed in it, same format.
+		if (getenv("IRCSERV_EXEMPT"))
+			server.load_exemptions(getenv("IRCSERV_EXEMPT"));
+		// IRCSERV_TLS_PORT=<port> listens for TLS there too, with the
+		// PEM files IRCSERV_TLS_CERT and IRCSERV_TLS_KEY, or a
+		// self-signed certificate without them.
+		if (getenv("IRCSERV_TLS_PORT"))
+			server.enable_tls(getenv("IRCSERV_TLS_PORT"),
+					  getenv("IRCSERV_TLS_CERT") ? getenv("IRCSERV_TLS_CERT") : "",
+					  getenv("IRCSERV_TLS_KEY") ? getenv("IRCSERV_TLS_KEY") : "");
+		// IRCSERV_CLIENT_MEMORY and IRCSERV_MEMORY_BUDGET, in bytes,
+		// override CLIENT_MEMORY_LIMIT and MEMORY_BUDGET.
+		if (getenv("IRCSERV_CLIENT_MEMORY") || getenv("IRCSERV_MEMORY_BUDGET"))
+			server.set_memory_limits(
+			    getenv("IRCSERV_CLIENT_MEMORY") ? strtoull(getenv("IRCSERV_CLIENT_MEMORY"), NULL, 10) : CLIENT_MEMORY_LIMIT,
+			    getenv("IRCSERV_MEMORY_BUDGET") ? strtoull(getenv("IRCSERV_MEMORY_BUDGET"), NULL, 10) : MEMORY_BUDGET);
+		// IRCSERV_OPER="<name> <password>" lets that OPER in.
+		if (getenv("IRCSERV_OPER")) {
+			std::string oper = getenv("IRCSERV_OPER");
+			size_t space = oper.find(' ');
+			if (space != std::string::npos)
+				server.set_oper(oper.substr(0, space), oper.substr(space + 1));
+		}
 		server.start();
+		const Overload::stats &overload = server.get_overload_stats();
+		std::cout << "Overload: " << overload.accept_pauses << " accept pauses ("
+			  << overload.descriptor_pauses << " out of descriptors), "
+			  << overload.limited_reads << " limited reads, "
+			  << overload.dropped_notices << " dropped notices, "
+			  << overload.shed_clients << " shed clients, peak lag "
+			  << overload.peak_lag_nanoseconds / 1000000.0 << " ms, peak output "
+			  << overload.peak_output_bytes << " bytes" << std::endl;
+		const History::stats &history = server.get_history_stats();
+		std::cout << "History: " << history.appended << " lines kept, "
+			  << history.replayed << " replayed, " << history.dropped
+			  << " dropped, " << history.evicted << " channels evicted, "
+			  << history.channels << " channels" << std::endl;
+		if (getenv("IRCSERV_LINKS")) {
+			const link_stats &links = server.get_link_stats();
+			std::cout << "Links: " << links.bursts << " bursts, " << links.burst_lines
+				  << " lines, " << links.burst_bytes << " bytes, " << links.netsplits
+				  << " netsplits, " << links.split_users << " users split, "
+				  << links.relayed << " relayed, " << links.relay_bytes_saved
+				  << " bytes saved, " << links.link_lines << " lines in "
+				  << links.link_writes << " writes" << std::endl;
+		}
+		const compression_stats &compression = server.get_compression_stats();
+		if (compression.clients)
+			std::cout << "Compression: " << compression.clients << " clients, "
+				  << compression.batches << " batches, " << compression.bytes_in
+				  << " bytes in, " << compression.bytes_out << " bytes out, "
+				  << compression.nanoseconds / 1000000.0 << " ms" << std::endl;
+		if (getenv("IRCSERV_TLS_PORT")) {
+			const tls_stats &tls = server.get_tls_stats();
+			std::cout << "TLS: " << tls.handshakes << " handshakes, "
+				  << tls.failed_handshakes << " failed, " << tls.kernel_send
+				  << " sending in the kernel, " << tls.kernel_recv
+				  << " receiving in the kernel" << std::endl;
+		}
+		const memory_stats &memory = server.get_memory_stats();
+		std::cout << "Memory: peak " << memory.peak << " bytes, "
+			  << memory.limit_closes << " users over the limit, "
+			  << memory.budget_closes << " closed for the budget" << std::endl;
+		const closing_stats &closed = server.get_closing_stats();
+		std::cout << "Closing: " << closed.clients << " clients in " << closed.batches
+			  << " batches, at most " << closed.largest_batch << " at once" << std::endl;
+		const task_stats &tasks = server.get_task_stats();
+		if (tasks.started)
+			std::cout << "Tasks: " << tasks.started << " started, " << tasks.deferred
+				  << " deferred, " << tasks.steps << " steps, at most "
+				  << tasks.most_steps << " for one, " << tasks.budget_stops
+				  << " budget stops, " << tasks.waited << " waited, "
+				  << tasks.refused << " refused, "
+				  << tasks.nanoseconds / 1000000.0 << " ms" << std::endl;
+		const reply_cache_stats &cache = server.get_reply_cache_stats();
+		if (cache.list_hits + cache.list_misses + cache.who_hits + cache.who_misses)
+			std::cout << "Reply cache: LIST " << cache.list_hits << " hits, "
+				  << cache.list_misses << " misses, WHO " << cache.who_hits
+				  << " hits, " << cache.who_misses << " misses" << std::endl;
+		if (const ChannelLog::stats *log = server.get_log_stats())
+			std::cout << "Log: " << log->records << " records, " << log->bytes
+				  << " bytes, " << log->rotations << " rotations, "
+				  << log->stalls << " stalls, " << log->syncs << " syncs, "
+				  << log->dropped << " dropped" << std::endl;
 	}catch (std::exception &e) {
 		std::cerr << e.what() << std::endl;
         return 1;